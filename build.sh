@@ -0,0 +1,4 @@
+#!/bin/sh
+g++ -g -O2 -pthread "$@" "src/main_linux.cpp" -o "keyboard-recorder"
+g++ -g -O2 -pthread "$@" "src/main_bench.cpp" -o "keyboard-recorder-bench"
+g++ -g -O2 -pthread "$@" "src/main_test.cpp" -o "keyboard-recorder-test"
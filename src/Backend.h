@@ -0,0 +1,124 @@
+#pragma once
+#include <stdint.h>
+#include <condition_variable>
+#include <mutex>
+#include "DynamicArray.h"
+#include "RingBuffer.h"
+
+typedef int32_t int32;
+typedef int64_t int64;
+typedef unsigned int uint;
+typedef uint32_t uint32;
+typedef uint64_t uint64;
+
+// Keys are stored as PC set 1 scancodes on every platform so recordings can be shared.
+struct KeyInput
+{
+	enum Type { press, release };
+
+	unsigned short scancode;
+	unsigned int extended;
+	Type type;
+	uint64 time; // When the event arrived, on the backend's clock
+};
+
+// Capture threads hand key events to the recorder through one of these.
+// At 1000 Hz polling that is about a second of continuous events before anything is dropped.
+typedef RingBuffer<KeyInput, 1024> CaptureRing;
+
+void drainCaptureRing(CaptureRing* ring, DynamicArray<KeyInput>* out)
+{
+	KeyInput key;
+	while (ring->pop(&key)) {
+		out->push_back(key);
+	}
+}
+
+// Capture threads set this after pushing keys, so the recorder can sleep until there are some.
+// It stays set until the waiter sees it, so keys pushed just before the wait aren't missed.
+struct CaptureSignal
+{
+	std::mutex lock;
+	std::condition_variable wake;
+	bool signaled;
+};
+
+void signalCapture(CaptureSignal* signal)
+{
+	{
+		std::lock_guard<std::mutex> guard(signal->lock);
+		signal->signaled = true;
+	}
+	signal->wake.notify_one();
+}
+
+void waitForCapture(CaptureSignal* signal)
+{
+	std::unique_lock<std::mutex> guard(signal->lock);
+	signal->wake.wait(guard, [signal] { return signal->signaled; });
+	signal->signaled = false;
+}
+
+// Everything the recorder needs from the OS. Each backend fills in the function pointers
+// and passes its own state through data.
+struct InputBackend
+{
+	void* data;
+	// Capture source. Appends key events that arrived since the last call.
+	void (*captureKeys)(void* data, DynamicArray<KeyInput>* out);
+	// Number of key events lost because the recorder didn't keep up with capture
+	uint32 (*getDroppedKeyCount)(void* data);
+	// Injection sink. Keys in one call should reach the OS together, as one input report where possible.
+	void (*injectKeys)(void* data, const KeyInput* keys, uint count);
+	// Frame clock. Monotonic time in nanoseconds from an arbitrary starting point.
+	uint64 (*getTime)(void* data);
+	void (*sleepUntil)(void* data, uint64 time);
+	// Sleeps until keys are captured or wakeUp is called from another thread, for when there are no
+	// frames to keep. Returns straight away if either happened since the last wait.
+	void (*waitForKeys)(void* data);
+	void (*wakeUp)(void* data);
+	// Called from the playback thread so it gets scheduled ahead of the game and GUI
+	void (*raiseThreadPriority)(void* data);
+	// Writes the key's name into name, which holds size characters
+	void (*keyName)(void* data, KeyInput key, char* name, uint size);
+};
+
+void captureKeys(InputBackend* backend, DynamicArray<KeyInput>* out)
+{
+	backend->captureKeys(backend->data, out);
+}
+
+uint32 getDroppedKeyCount(InputBackend* backend)
+{
+	return backend->getDroppedKeyCount(backend->data);
+}
+
+void injectKeys(InputBackend* backend, const KeyInput* keys, uint count)
+{
+	backend->injectKeys(backend->data, keys, count);
+}
+
+uint64 getTime(InputBackend* backend)
+{
+	return backend->getTime(backend->data);
+}
+
+void sleepUntil(InputBackend* backend, uint64 time)
+{
+	backend->sleepUntil(backend->data, time);
+}
+
+void waitForKeys(InputBackend* backend)
+{
+	backend->waitForKeys(backend->data);
+}
+
+void wakeUp(InputBackend* backend)
+{
+	backend->wakeUp(backend->data);
+}
+
+void raiseThreadPriority(InputBackend* backend)
+{
+	backend->raiseThreadPriority(backend->data);
+}
@@ -1,3 +1,4 @@
+#pragma once
 #include <stdlib.h>
 #include <assert.h>
 
@@ -35,8 +36,8 @@ template <class T> struct DynamicArray
 	DynamicArray<T> deepCopy() {
 		DynamicArray<T> result;
 		result.count = count;
-		result.allocatedCount = allocatedCount;
-		result.data = (T*)malloc(allocatedCount * sizeof(T));
+		result.allocatedCount = allocatedCount > count ? allocatedCount : count;
+		result.data = (T*)malloc(result.allocatedCount * sizeof(T));
 		for (unsigned int i = 0; i < count; ++i) {
 			result.data[i] = data[i];
 		}
@@ -0,0 +1,162 @@
+#pragma once
+#include "Backend.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CPU_PAUSE() _mm_pause()
+#else
+#define CPU_PAUSE()
+#endif
+
+// Paces frames at a fixed rate with absolute deadlines, independent of the monitor and GPU driver.
+// Waiting sleeps on the backend's timer until spinTime before the deadline, then spins the rest,
+// which is far more accurate than sleeping alone and far cheaper than spinning alone.
+// The rate is a fraction (e.g. 60000/1001 for 59.94 Hz) so frames stay in lockstep with
+// emulated hardware over long sessions instead of drifting by the rounding of the period.
+struct FrameClock
+{
+	uint64 rateNumerator;   // Frames per second is rateNumerator / rateDenominator
+	uint64 rateDenominator;
+	// The period is framePeriod + periodRemainder / rateNumerator nanoseconds.
+	// The remainder is accumulated and paid out a nanosecond at a time.
+	uint64 framePeriod;
+	uint64 periodRemainder;
+	uint64 remainderAccumulator;
+	uint64 nextFrameTime; // Absolute deadline of the next frame
+	uint64 spinTime;      // Should cover the backend timer's worst oversleep. 0 sleeps all the way.
+	// Deadline error, how long after the frame deadline the wait actually returned
+	int64 lastError;
+	int64 worstError;
+	int64 totalError;
+	uint64 measuredFrames;
+	uint64 frameStreak; // Frames measured in a row since the clock was started or resumed
+};
+
+// Numerator and denominator should stay under a billion to keep the math in 64 bits
+void setFrameRate(FrameClock* clock, uint64 rateNumerator, uint64 rateDenominator)
+{
+	clock->rateNumerator = rateNumerator;
+	clock->rateDenominator = rateDenominator;
+	clock->framePeriod = 1000000000ull * rateDenominator / rateNumerator;
+	clock->periodRemainder = 1000000000ull * rateDenominator % rateNumerator;
+	clock->remainderAccumulator = 0;
+}
+
+void initFrameClock(FrameClock* clock, uint64 rateNumerator, uint64 rateDenominator, uint64 spinTime)
+{
+	*clock = {0};
+	setFrameRate(clock, rateNumerator, rateDenominator);
+	clock->spinTime = spinTime;
+}
+
+// Accepts "60", "59.94" or "60000/1001"
+bool parseFrameRate(const char* text, uint64* rateNumerator, uint64* rateDenominator)
+{
+	uint64 numerator = 0;
+	uint64 denominator = 1;
+	const char* c = text;
+	for (; *c >= '0' && *c <= '9'; ++c) numerator = numerator*10 + (*c - '0');
+	if (*c == '.') {
+		for (++c; *c >= '0' && *c <= '9' && denominator < 100000000; ++c) {
+			numerator = numerator*10 + (*c - '0');
+			denominator *= 10;
+		}
+	}
+	else if (*c == '/') {
+		denominator = 0;
+		for (++c; *c >= '0' && *c <= '9'; ++c) denominator = denominator*10 + (*c - '0');
+	}
+	if (*c != 0 || c == text || numerator == 0 || denominator == 0 || numerator >= 1000000000ull || denominator >= 1000000000ull) {
+		return false;
+	}
+	*rateNumerator = numerator;
+	*rateDenominator = denominator;
+	return true;
+}
+
+double framesPerSecond(FrameClock* clock)
+{
+	return (double)clock->rateNumerator / (double)clock->rateDenominator;
+}
+
+// Moves the deadline forward by exactly one period, so a late frame doesn't push every later frame back
+void advanceFrame(FrameClock* clock)
+{
+	clock->nextFrameTime += clock->framePeriod;
+	clock->remainderAccumulator += clock->periodRemainder;
+	if (clock->remainderAccumulator >= clock->rateNumerator) {
+		clock->remainderAccumulator -= clock->rateNumerator;
+		clock->nextFrameTime += 1;
+	}
+}
+
+// The accumulator starts one short of paying out, so the kth deadline after a start or resume is
+// timeAtFrame(k) later, rounded up the same way. Keys injected on a deadline then map back to the frame
+// they were played on.
+void startFrameClock(FrameClock* clock, uint64 now)
+{
+	clock->remainderAccumulator = clock->rateNumerator - 1;
+	clock->nextFrameTime = now;
+	clock->frameStreak = 0;
+	advanceFrame(clock);
+}
+
+// Picks frames back up after a wait that didn't keep them, so the frames slept through aren't run
+// one after another to catch up. The frame that was in progress ends now.
+void resumeFrameClock(FrameClock* clock, uint64 now)
+{
+	clock->remainderAccumulator = clock->rateNumerator - 1;
+	clock->nextFrameTime = now;
+	clock->frameStreak = 0;
+}
+
+// Frame number of a time offset from the start of a recording, i.e. floor(time * rate).
+// Split into whole seconds and the rest so the products fit in 64 bits.
+uint32 frameAtTime(FrameClock* clock, uint64 time)
+{
+	uint64 seconds = time / 1000000000ull;
+	uint64 nanoseconds = time % 1000000000ull;
+	uint64 secondFrames = seconds * clock->rateNumerator;
+	uint64 wholeFrames = secondFrames / clock->rateDenominator;
+	uint64 leftover = (secondFrames % clock->rateDenominator) * 1000000000ull + nanoseconds * clock->rateNumerator;
+	return (uint32)(wholeFrames + leftover / (1000000000ull * clock->rateDenominator));
+}
+
+// Start of a frame as a time offset from the start of a recording, i.e. ceil(frame / rate)
+uint64 timeAtFrame(FrameClock* clock, uint32 frame)
+{
+	uint64 scaled = frame * clock->rateDenominator;
+	uint64 seconds = scaled / clock->rateNumerator;
+	uint64 leftover = (scaled % clock->rateNumerator) * 1000000000ull;
+	return seconds * 1000000000ull + (leftover + clock->rateNumerator - 1) / clock->rateNumerator;
+}
+
+// Waits until deadline, which may be earlier than the next frame (e.g. exact timing playback).
+// Only waits on the frame deadline count toward the error stats.
+void waitForDeadline(FrameClock* clock, InputBackend* backend, uint64 deadline)
+{
+	uint64 now = getTime(backend);
+	if (deadline > now + clock->spinTime) {
+		sleepUntil(backend, deadline - clock->spinTime);
+	}
+	if (clock->spinTime == 0) {
+		sleepUntil(backend, deadline);
+	}
+	while ((now = getTime(backend)) < deadline) {
+		CPU_PAUSE();
+	}
+
+	if (deadline == clock->nextFrameTime) {
+		int64 error = (int64)(now - deadline);
+		clock->lastError = error;
+		if (error > clock->worstError) clock->worstError = error;
+		clock->totalError += error;
+		clock->measuredFrames += 1;
+		clock->frameStreak += 1;
+	}
+}
+
+int64 averageFrameError(FrameClock* clock)
+{
+	return clock->measuredFrames ? clock->totalError / (int64)clock->measuredFrames : 0;
+}
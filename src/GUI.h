@@ -7,7 +7,8 @@
 #define NK_INCLUDE_DEFAULT_FONT
 #define NK_IMPLEMENTATION
 #include "nuklear/nuklear.h"
-#include <string>
+#include "MappedFile.h"
+#include "RecordingFile.h"
 
 struct nk_vertex {
 	float position[2];
@@ -15,16 +16,30 @@ struct nk_vertex {
 	nk_byte col[4];
 };
 
+// nk_convert's output goes into one block allocated in initGUI, so drawing a frame never allocates.
+// The window needs about a tenth of this.
+const nk_size guiCommandMemory = 32*1024;
+const nk_size guiVertexMemory = 512*1024;
+const nk_size guiElementMemory = 128*1024;
+
 struct GUI
 {
 	nk_context ctx;
 	nk_font_atlas atlas;
 	nk_buffer cmds;
+	nk_buffer vertices;
+	nk_buffer elements;
 	nk_draw_null_texture null;
 	GLuint font_tex;
+
+	// Nuklear's commands for what's on screen, to tell whether the next frame needs drawing
+	void* drawnCommands;
+	nk_size drawnCommandsSize;
+	nk_size drawnCommandsCapacity;
+	int drawnWidth, drawnHeight;
 };
 
-bool doButton(nk_context* ctx, std::string label, bool yellow)
+bool doButton(nk_context* ctx, const char* label, bool yellow)
 {
 	bool result = false;
 
@@ -34,7 +49,7 @@ bool doButton(nk_context* ctx, std::string label, bool yellow)
 		nk_style_push_style_item(ctx, &ctx->style.button.active, nk_style_item_color(nk_rgb(255, 255, 0)));
 	}
 
-	result = nk_button_label(ctx, label.c_str());
+	result = nk_button_label(ctx, label);
 
 	if (yellow) {
 		nk_style_pop_style_item(ctx);
@@ -45,24 +60,162 @@ bool doButton(nk_context* ctx, std::string label, bool yellow)
 	return result;
 }
 
-void initGUI(GUI* gui)
+// Baking the font rasterizes every glyph, which is most of the startup time, so the result is cached
+// on disk. The cache is a dump of Nuklear's structs for this build, keyed by a hash of the font's
+// config and TTF data, so anything that doesn't match or fails its checksum is just baked again.
+//   "KRFA"                 magic
+//   uint32 uint32          hash of the font config, hash of the TTF data
+//   uint32                 FNV-1a checksum of the glyphs and image
+//   int32 int32            atlas width and height
+//   uint32                 glyph count
+//   nk_recti               custom rectangle with the white pixel and cursors
+//   nk_baked_font          without ranges
+//   nk_cursor[]            NK_CURSOR_COUNT of them
+//   nk_font_glyph[]
+//   uint8[]                alpha8 atlas
+const char fontCacheMagic[4] = {'K', 'R', 'F', 'A'};
+
+struct FontCacheHeader
+{
+	char magic[4];
+	uint32 configHash;
+	uint32 dataHash;
+	uint32 checksum;
+	int32_t width, height;
+	uint32 glyphCount;
+	struct nk_recti custom;
+	nk_baked_font font;
+	nk_cursor cursors[NK_CURSOR_COUNT];
+};
+
+uint32 fontConfigHash(struct nk_font_config* config)
+{
+	struct {
+		float size;
+		int coordType;
+		struct nk_vec2 spacing;
+		uint32 oversampleH, oversampleV, pixelSnap;
+		nk_rune fallback;
+		uint32 glyphSize, cursorCount;
+		nk_rune ranges[32];
+	} key = {0};
+	key.size = config->size;
+	key.coordType = config->coord_type;
+	key.spacing = config->spacing;
+	key.oversampleH = config->oversample_h;
+	key.oversampleV = config->oversample_v;
+	key.pixelSnap = config->pixel_snap;
+	key.fallback = config->fallback_glyph;
+	key.glyphSize = sizeof(nk_font_glyph);
+	key.cursorCount = NK_CURSOR_COUNT;
+	for (uint i = 0; i < 31 && config->range[i]; ++i) {
+		key.ranges[i] = config->range[i];
+	}
+	return fnv1a((unsigned char*)&key, sizeof(key));
+}
+
+// Sets the atlas up as baking it would, from the cache. Returns the alpha8 image, which lives in
+// cache, or 0 if there is no matching cache.
+const void* loadFontAtlas(nk_font_atlas* atlas, MappedFile* cache, const char* path, int* width, int* height)
+{
+	struct nk_font_config* config = atlas->config;
+	FontCacheHeader header;
+	if (!path || atlas->font_num != 1 || !mapFile(cache, path)) {
+		return 0;
+	}
+	if (cache->size < sizeof(header)) {
+		unmapFile(cache);
+		return 0;
+	}
+	memcpy(&header, cache->bytes, sizeof(header));
+	size_t size = sizeof(header) + (size_t)header.glyphCount * sizeof(nk_font_glyph) + (size_t)header.width * header.height;
+	if (memcmp(header.magic, fontCacheMagic, 4) != 0 || header.configHash != fontConfigHash(config) ||
+		header.dataHash != fnv1a((unsigned char*)config->ttf_blob, config->ttf_size) ||
+		header.width <= 0 || header.height <= 0 || header.glyphCount == 0 || cache->size != size ||
+		fnv1a(cache->bytes + sizeof(header), size - sizeof(header)) != header.checksum) {
+		unmapFile(cache);
+		return 0;
+	}
+
+	atlas->glyph_count = (int)header.glyphCount;
+	atlas->glyphs = (nk_font_glyph*)atlas->permanent.alloc(atlas->permanent.userdata, 0, sizeof(nk_font_glyph) * header.glyphCount);
+	memcpy(atlas->glyphs, cache->bytes + sizeof(header), sizeof(nk_font_glyph) * header.glyphCount);
+	atlas->custom = header.custom;
+	memcpy(atlas->cursors, header.cursors, sizeof(atlas->cursors));
+	atlas->tex_width = header.width;
+	atlas->tex_height = header.height;
+	header.font.ranges = config->range;
+	*config->font = header.font;
+	nk_font_init(atlas->fonts, config->size, config->fallback_glyph, atlas->glyphs, config->font, nk_handle_ptr(0));
+
+	*width = header.width;
+	*height = header.height;
+	return cache->bytes + sizeof(header) + sizeof(nk_font_glyph) * header.glyphCount;
+}
+
+void saveFontAtlas(nk_font_atlas* atlas, const char* path, const void* image, int width, int height)
+{
+	struct nk_font_config* config = atlas->config;
+	FontCacheHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, fontCacheMagic, 4);
+	header.configHash = fontConfigHash(config);
+	header.dataHash = fnv1a((unsigned char*)config->ttf_blob, config->ttf_size);
+	header.width = width;
+	header.height = height;
+	header.glyphCount = (uint32)atlas->glyph_count;
+	header.custom = atlas->custom;
+	header.font = *config->font;
+	header.font.ranges = 0;
+	memcpy(header.cursors, atlas->cursors, sizeof(header.cursors));
+
+	size_t glyphSize = sizeof(nk_font_glyph) * header.glyphCount;
+	size_t imageSize = (size_t)width * height;
+	unsigned char* body = (unsigned char*)malloc(glyphSize + imageSize);
+	memcpy(body, atlas->glyphs, glyphSize);
+	memcpy(body + glyphSize, image, imageSize);
+	header.checksum = fnv1a(body, glyphSize + imageSize);
+
+	FILE* file = fopen(path, "wb");
+	if (file) {
+		fwrite(&header, sizeof(header), 1, file);
+		fwrite(body, 1, glyphSize + imageSize, file);
+		fclose(file);
+	}
+	free(body);
+}
+
+// fontCachePath is where the baked font is cached, or 0 to always bake it
+void initGUI(GUI* gui, const char* fontCachePath)
 {
 	*gui = {0};
 	nk_init_default(&gui->ctx, 0);
-	nk_buffer_init_default(&gui->cmds);
+	char* drawMemory = (char*)malloc(guiCommandMemory + guiVertexMemory + guiElementMemory);
+	nk_buffer_init_fixed(&gui->cmds, drawMemory, guiCommandMemory);
+	nk_buffer_init_fixed(&gui->vertices, drawMemory + guiCommandMemory, guiVertexMemory);
+	nk_buffer_init_fixed(&gui->elements, drawMemory + guiCommandMemory + guiVertexMemory, guiElementMemory);
 	
 	nk_font_atlas_init_default(&gui->atlas);
 	nk_font_atlas_begin(&gui->atlas);
+	gui->atlas.default_font = nk_font_atlas_add_default(&gui->atlas, 13.0f, 0);
 
-	const void *image;
 	int w, h;
-	image = nk_font_atlas_bake(&gui->atlas, &w, &h, NK_FONT_ATLAS_RGBA32);
+	MappedFile cache = {0};
+	const void* alpha = loadFontAtlas(&gui->atlas, &cache, fontCachePath, &w, &h);
+	if (!alpha) {
+		alpha = nk_font_atlas_bake(&gui->atlas, &w, &h, NK_FONT_ATLAS_ALPHA8);
+		if (alpha && fontCachePath) saveFontAtlas(&gui->atlas, fontCachePath, alpha, w, h);
+	}
+	void* image = malloc((size_t)w * h * 4);
+	nk_font_bake_convert(image, w, h, alpha);
+	unmapFile(&cache);
 	
 	glGenTextures(1, &gui->font_tex);
 	glBindTexture(GL_TEXTURE_2D, gui->font_tex);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, image);
+	free(image);
 	
 	nk_font_atlas_end(&gui->atlas, nk_handle_id((int)gui->font_tex), &gui->null);
 	if (gui->atlas.default_font)
@@ -111,7 +264,6 @@ void renderNuklear(GUI* gui, int display_width, int display_height, enum nk_anti
 		/* convert from command queue into draw list and draw to screen */
 		const struct nk_draw_command *cmd;
 		const nk_draw_index *offset = NULL;
-		struct nk_buffer vbuf, ebuf;
 
 		/* fill converting configuration */
 		struct nk_convert_config config;
@@ -134,18 +286,20 @@ void renderNuklear(GUI* gui, int display_width, int display_height, enum nk_anti
 		config.line_AA = AA;
 
 		/* convert shapes into vertexes */
-		nk_buffer_init_default(&vbuf);
-		nk_buffer_init_default(&ebuf);
-		nk_convert(&gui->ctx, &gui->cmds, &vbuf, &ebuf, &config);
+		nk_buffer_clear(&gui->cmds);
+		nk_buffer_clear(&gui->vertices);
+		nk_buffer_clear(&gui->elements);
+		nk_flags converted = nk_convert(&gui->ctx, &gui->cmds, &gui->vertices, &gui->elements, &config);
+		ASSERT(converted == NK_CONVERT_SUCCESS, "GUI draw memory is full");
 
 		/* setup vertex buffer pointer */
-		{const void *vertices = nk_buffer_memory_const(&vbuf);
+		{const void *vertices = nk_buffer_memory_const(&gui->vertices);
 		glVertexPointer(2, GL_FLOAT, vs, (const void*)((const nk_byte*)vertices + vp));
 		glTexCoordPointer(2, GL_FLOAT, vs, (const void*)((const nk_byte*)vertices + vt));
 		glColorPointer(4, GL_UNSIGNED_BYTE, vs, (const void*)((const nk_byte*)vertices + vc)); }
 
 		/* iterate over and execute each draw command */
-		offset = (const nk_draw_index*)nk_buffer_memory_const(&ebuf);
+		offset = (const nk_draw_index*)nk_buffer_memory_const(&gui->elements);
 		nk_draw_foreach(cmd, &gui->ctx, &gui->cmds)
 		{
 			if (!cmd->elem_count) continue;
@@ -159,8 +313,6 @@ void renderNuklear(GUI* gui, int display_width, int display_height, enum nk_anti
 			offset += cmd->elem_count;
 		}
 		nk_clear(&gui->ctx);
-		nk_buffer_free(&vbuf);
-		nk_buffer_free(&ebuf);
 	}
 
 	/* default OpenGL state */
@@ -182,9 +334,39 @@ void renderNuklear(GUI* gui, int display_width, int display_height, enum nk_anti
 	glPopAttrib();
 }
 
-void renderGUI(GUI* gui, int displayWidth, int displayHeight)
+// Nuklear records the whole GUI as a command buffer each frame, so the same bytes mean the same picture.
+// Keeps a copy of the commands to compare the next frame against.
+bool guiChanged(GUI* gui, int displayWidth, int displayHeight)
 {
+	const void* commands = nk_buffer_memory_const(&gui->ctx.memory);
+	nk_size size = gui->ctx.memory.allocated;
+	if (displayWidth == gui->drawnWidth && displayHeight == gui->drawnHeight && size == gui->drawnCommandsSize &&
+		memcmp(commands, gui->drawnCommands, size) == 0) {
+		return false;
+	}
+
+	if (size > gui->drawnCommandsCapacity) {
+		free(gui->drawnCommands);
+		gui->drawnCommands = malloc(size);
+		gui->drawnCommandsCapacity = size;
+	}
+	memcpy(gui->drawnCommands, commands, size);
+	gui->drawnCommandsSize = size;
+	gui->drawnWidth = displayWidth;
+	gui->drawnHeight = displayHeight;
+	return true;
+}
+
+// Returns false without drawing if the GUI looks the same as what is already on screen,
+// in which case there is nothing to swap either
+bool renderGUI(GUI* gui, int displayWidth, int displayHeight)
+{
+	if (!guiChanged(gui, displayWidth, displayHeight)) {
+		nk_clear(&gui->ctx);
+		return false;
+	}
 	glClearColor(0, 0, 0, 0);
 	glClear(GL_COLOR_BUFFER_BIT);
 	renderNuklear(gui, displayWidth, displayHeight, NK_ANTI_ALIASING_ON);
+	return true;
 }
\ No newline at end of file
@@ -0,0 +1,151 @@
+#pragma once
+#include <stdio.h>
+#include <atomic>
+#include "Backend.h"
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// Log-linear histogram of nanosecond durations in fixed memory, laid out like HdrHistogram.
+// Values under 256ns are counted exactly. Above that, each power of two is split into 128 buckets,
+// so a value is never off by more than 1/128 of itself, up to about 18 minutes where values are clamped.
+// One thread records and any thread can read, without locks. A reader racing the writer may see a
+// count that is one value behind another, which doesn't matter for percentiles.
+const uint histogramExactValues = 256;
+const uint histogramSubBuckets = 128;
+const uint histogramMaxBit = 40;
+const uint histogramBucketCount = histogramExactValues + (histogramMaxBit - 8) * histogramSubBuckets;
+
+struct Histogram
+{
+	std::atomic<uint32> counts[histogramBucketCount];
+	std::atomic<uint64> count;
+	std::atomic<uint64> total;
+	std::atomic<uint64> max;
+};
+
+// value must not be 0
+uint highestBit(uint64 value)
+{
+#if defined(_MSC_VER) && defined(_M_IX86)
+	// 32-bit builds only have the 32-bit scan
+	unsigned long index;
+	if (_BitScanReverse(&index, (unsigned long)(value >> 32))) return index + 32;
+	_BitScanReverse(&index, (unsigned long)value);
+	return index;
+#elif defined(_MSC_VER)
+	unsigned long index;
+	_BitScanReverse64(&index, value);
+	return index;
+#else
+	return 63 - __builtin_clzll(value);
+#endif
+}
+
+uint histogramBucket(uint64 value)
+{
+	if (value < histogramExactValues) return (uint)value;
+	uint bit = highestBit(value);
+	if (bit >= histogramMaxBit) return histogramBucketCount - 1;
+	uint subBucket = (uint)(value >> (bit - 7)) & (histogramSubBuckets - 1);
+	return histogramExactValues + (bit - 8) * histogramSubBuckets + subBucket;
+}
+
+// Highest value that lands in bucket
+uint64 histogramBucketValue(uint bucket)
+{
+	if (bucket < histogramExactValues) return bucket;
+	uint bit = 8 + (bucket - histogramExactValues) / histogramSubBuckets;
+	uint64 subBucket = (bucket - histogramExactValues) % histogramSubBuckets;
+	return ((histogramSubBuckets + subBucket + 1) << (bit - 7)) - 1;
+}
+
+void clearHistogram(Histogram* histogram)
+{
+	for (uint i=0; i<histogramBucketCount; ++i) {
+		histogram->counts[i].store(0, std::memory_order_relaxed);
+	}
+	histogram->count.store(0, std::memory_order_relaxed);
+	histogram->total.store(0, std::memory_order_relaxed);
+	histogram->max.store(0, std::memory_order_relaxed);
+}
+
+// Only one thread may record into a histogram. Negative durations count as 0.
+void recordDuration(Histogram* histogram, int64 duration)
+{
+	uint64 value = duration > 0 ? (uint64)duration : 0;
+	std::atomic<uint32>* bucket = &histogram->counts[histogramBucket(value)];
+	bucket->store(bucket->load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	histogram->count.store(histogram->count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	histogram->total.store(histogram->total.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+	if (value > histogram->max.load(std::memory_order_relaxed)) {
+		histogram->max.store(value, std::memory_order_relaxed);
+	}
+}
+
+// Percentiles are the highest value in the bucket they fall in, so they never understate
+struct HistogramSummary
+{
+	uint64 count;
+	uint64 mean;
+	uint64 p50;
+	uint64 p90;
+	uint64 p99;
+	uint64 p999;
+	uint64 max;
+};
+
+HistogramSummary summarizeHistogram(Histogram* histogram)
+{
+	HistogramSummary summary = {0};
+	summary.count = histogram->count.load(std::memory_order_relaxed);
+	summary.max = histogram->max.load(std::memory_order_relaxed);
+	if (summary.count == 0) return summary;
+	summary.mean = histogram->total.load(std::memory_order_relaxed) / summary.count;
+
+	const double percentiles[] = {0.5, 0.9, 0.99, 0.999};
+	uint64* results[] = {&summary.p50, &summary.p90, &summary.p99, &summary.p999};
+	uint next = 0;
+	uint64 seen = 0;
+	for (uint i=0; i<histogramBucketCount && next < 4; ++i) {
+		seen += histogram->counts[i].load(std::memory_order_relaxed);
+		while (next < 4 && seen >= (uint64)(percentiles[next] * summary.count + 0.5)) {
+			*results[next++] = histogramBucketValue(i);
+		}
+	}
+	// The bucket's top can be past the largest value actually recorded
+	for (uint i=0; i<4; ++i) {
+		if (*results[i] > summary.max) *results[i] = summary.max;
+	}
+	return summary;
+}
+
+// Timing of the recorder itself, so claims like "99.9% of keys are injected within 50us" can be checked.
+// Kept by the recorder thread when AppData::timing is set.
+struct TimingStats
+{
+	Histogram injectionDelay;   // How long after it was due each played back key reached the backend
+	Histogram captureLatency;   // How long after it arrived each recorded key was recorded
+	Histogram framePeriodError; // How far each frame's length was from the nominal period, either way
+	int64 previousFrameError;
+};
+
+void clearTimingStats(TimingStats* timing)
+{
+	clearHistogram(&timing->injectionDelay);
+	clearHistogram(&timing->captureLatency);
+	clearHistogram(&timing->framePeriodError);
+	timing->previousFrameError = 0;
+}
+
+// One line per histogram, in microseconds
+void writeTimingStats(TimingStats* timing, FILE* file)
+{
+	const char* names[] = {"Injection delay", "Capture latency", "Frame period error"};
+	Histogram* histograms[] = {&timing->injectionDelay, &timing->captureLatency, &timing->framePeriodError};
+	for (uint i=0; i<3; ++i) {
+		HistogramSummary s = summarizeHistogram(histograms[i]);
+		fprintf(file, "%s: %llu samples, mean %.1fus, p50 %.1fus, p90 %.1fus, p99 %.1fus, p99.9 %.1fus, max %.1fus\n",
+			names[i], (unsigned long long)s.count, s.mean / 1000.0, s.p50 / 1000.0, s.p90 / 1000.0, s.p99 / 1000.0, s.p999 / 1000.0, s.max / 1000.0);
+	}
+}
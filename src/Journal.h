@@ -0,0 +1,284 @@
+#pragma once
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+#include "Profiler.h"
+#include "RecordingFile.h"
+
+// Crash-safe copy of the recording in progress. The recorder thread copies new packed events into
+// the front buffer every frame, and hands it to a writer thread when the writer has finished with
+// the back buffer. The recorder never waits on the writer or the disk. If the disk falls behind,
+// events just wait in the recording, which is still complete in memory.
+//
+// Journal file, little endian:
+//   "KRJL"           magic
+//   uint16           version, 1
+//   uint16           reserved, 0
+//   uint64 uint64    frame rate numerator and denominator
+//   blocks:          uint32 word count, uint32 FNV-1a checksum of the words, packed events
+// A block with no words marks the recording as finished. Recovery keeps every block up to the
+// first one that is cut short or fails its checksum.
+const char journalMagic[4] = {'K', 'R', 'J', 'L'};
+const uint journalHeaderSize = 24;
+const uint journalBufferSize = 4096;
+const std::chrono::milliseconds journalSyncInterval(250);
+
+struct JournalBuffer
+{
+	PackedInput words[journalBufferSize];
+	uint count;
+	bool restart; // Start the file over for a new recording at this rate before writing the words
+	uint64 rateNumerator;
+	uint64 rateDenominator;
+	bool finish;  // Mark the recording finished after the words
+};
+
+struct Journal
+{
+	const char* path;
+	JournalBuffer buffers[2];
+	// The recorder fills front. back belongs to the writer while backReady is set.
+	JournalBuffer* front;
+	JournalBuffer* back;
+	std::atomic<bool> backReady;
+	std::atomic<bool> quit;
+	std::mutex wakeLock;
+	std::condition_variable wake;
+	std::thread thread;
+
+	// Recorder thread only
+	bool active;       // A recording is being journaled
+	uint32 generation; // recordingGeneration of the recording being journaled
+	uint position;     // Events of the recording copied so far
+
+	// Writer thread only
+	FILE* file;
+	bool unsynced;
+	std::chrono::steady_clock::time_point lastSync;
+};
+
+void syncJournalFile(Journal* journal)
+{
+	PROFILE_ZONE("Sync journal");
+	fflush(journal->file);
+#ifdef _WIN32
+	_commit(_fileno(journal->file));
+#else
+	fsync(fileno(journal->file));
+#endif
+	journal->unsynced = false;
+	journal->lastSync = std::chrono::steady_clock::now();
+}
+
+void writeJournalBuffer(Journal* journal, JournalBuffer* buffer)
+{
+	PROFILE_ZONE("Write journal");
+	unsigned char header[journalHeaderSize];
+	if (buffer->restart) {
+		if (journal->file) fclose(journal->file);
+		journal->file = fopen(journal->path, "wb");
+		if (journal->file) {
+			memcpy(header, journalMagic, 4);
+			unsigned char* out = writeLittleEndian(header + 4, 1, 2);
+			out = writeLittleEndian(out, 0, 2);
+			out = writeLittleEndian(out, buffer->rateNumerator, 8);
+			writeLittleEndian(out, buffer->rateDenominator, 8);
+			fwrite(header, 1, journalHeaderSize, journal->file);
+			journal->unsynced = true;
+		}
+	}
+	if (!journal->file) return;
+
+	if (buffer->count > 0) {
+		unsigned char blockHeader[8];
+		writeLittleEndian(blockHeader, buffer->count, 4);
+		writeLittleEndian(blockHeader + 4, fnv1a((unsigned char*)buffer->words, buffer->count * 4), 4);
+		fwrite(blockHeader, 1, 8, journal->file);
+		fwrite(buffer->words, 4, buffer->count, journal->file);
+		journal->unsynced = true;
+	}
+	// Handing it to the OS right away covers the app crashing. The periodic sync covers the OS crashing.
+	fflush(journal->file);
+	if (buffer->finish) {
+		unsigned char endBlock[8] = {0};
+		fwrite(endBlock, 1, 8, journal->file);
+		syncJournalFile(journal);
+	}
+}
+
+void runJournalWriter(Journal* journal)
+{
+	PROFILE_THREAD("Journal writer");
+	while (true)
+	{
+		// The recorder doesn't take wakeLock, so a wakeup can be missed. The timeout bounds that.
+		{
+			std::unique_lock<std::mutex> guard(journal->wakeLock);
+			journal->wake.wait_for(guard, journalSyncInterval, [journal] { return journal->backReady.load() || journal->quit.load(); });
+		}
+
+		if (journal->backReady.load(std::memory_order_acquire)) {
+			writeJournalBuffer(journal, journal->back);
+			journal->back->count = 0;
+			journal->back->restart = false;
+			journal->back->finish = false;
+			journal->backReady.store(false, std::memory_order_release);
+		}
+		else if (journal->quit) {
+			break;
+		}
+
+		if (journal->file && journal->unsynced && std::chrono::steady_clock::now() - journal->lastSync >= journalSyncInterval) {
+			syncJournalFile(journal);
+		}
+	}
+
+	// The recorder thread has stopped by now, so whatever is left in front can be written too
+	writeJournalBuffer(journal, journal->front);
+	if (journal->file) {
+		syncJournalFile(journal);
+		fclose(journal->file);
+		journal->file = 0;
+	}
+}
+
+// The journal file isn't touched until the next recording starts, so recover it first.
+// path must outlive the journal.
+void startJournal(Journal* journal, const char* path)
+{
+	journal->path = path;
+	journal->front = &journal->buffers[0];
+	journal->back = &journal->buffers[1];
+	journal->front->count = journal->back->count = 0;
+	journal->front->restart = journal->back->restart = false;
+	journal->front->finish = journal->back->finish = false;
+	journal->backReady = false;
+	journal->quit = false;
+	journal->active = false;
+	journal->position = 0;
+	journal->file = 0;
+	journal->unsynced = false;
+	journal->lastSync = std::chrono::steady_clock::now();
+	journal->thread = std::thread(runJournalWriter, journal);
+}
+
+// Call after the recorder thread has stopped
+void stopJournal(Journal* journal)
+{
+	journal->quit = true;
+	journal->wake.notify_one();
+	journal->thread.join();
+}
+
+// Called by the recorder thread every frame. Never blocks.
+void updateJournal(Journal* journal, AppData* data)
+{
+	JournalBuffer* front = journal->front;
+	bool recording = data->mode == Mode_recording;
+	// A loaded recording or a saved replay has taken the journaled one's place. Its events don't belong
+	// in the journal, and the journaled recording had stopped, so what was copied is all of it.
+	bool replaced = journal->active && journal->generation != data->recordingGeneration;
+	if (replaced && !recording) {
+		front->finish = true;
+		journal->active = false;
+	}
+	if (recording && (!journal->active || replaced)) {
+		// Whatever is still waiting belonged to the old recording, which the new one replaces
+		front->count = 0;
+		front->finish = false;
+		front->restart = true;
+		front->rateNumerator = data->recording.clock.rateNumerator;
+		front->rateDenominator = data->recording.clock.rateDenominator;
+		journal->active = true;
+		journal->generation = data->recordingGeneration;
+		journal->position = 0;
+	}
+
+	if (journal->active) {
+		Recording* source = &data->recording;
+		while (journal->position < source->events.count && front->count < journalBufferSize) {
+			front->words[front->count++] = source->events[journal->position++];
+		}
+		// Once recording stops, finish after the last events are in
+		if (!recording && journal->position >= source->events.count) {
+			front->finish = true;
+			journal->active = false;
+		}
+	}
+
+	if ((front->count > 0 || front->restart || front->finish) && !journal->backReady.load(std::memory_order_acquire)) {
+		journal->front = journal->back;
+		journal->back = front;
+		journal->backReady.store(true, std::memory_order_release);
+		journal->wake.notify_one();
+	}
+}
+
+// True if events are waiting for the writer to free up the back buffer, so updateJournal needs calling again soon
+bool journalPending(Journal* journal)
+{
+	JournalBuffer* front = journal->front;
+	return front->count > 0 || front->restart || front->finish;
+}
+
+// Rebuilds the journaled recording. finished is set if it was stopped normally rather than cut off.
+// Returns false if there is no journal or it has no inputs.
+bool recoverJournal(Recording* recording, const char* path, bool* finished)
+{
+	*finished = false;
+	MappedFile mapped;
+	if (!mapFile(&mapped, path)) {
+		return false;
+	}
+	const unsigned char* bytes = mapped.bytes;
+	uint64 rateNumerator = mapped.size >= journalHeaderSize ? readLittleEndian(bytes + 8, 8) : 0;
+	uint64 rateDenominator = mapped.size >= journalHeaderSize ? readLittleEndian(bytes + 16, 8) : 0;
+	if (mapped.size < journalHeaderSize || memcmp(bytes, journalMagic, 4) != 0 || !validFrameRate(rateNumerator, rateDenominator)) {
+		unmapFile(&mapped);
+		return false;
+	}
+
+	FrameClock clock;
+	initFrameClock(&clock, rateNumerator, rateDenominator, 0);
+	clearRecording(recording, &clock);
+	size_t offset = journalHeaderSize;
+	uint64 frame = 0;
+	bool intact = true;
+	while (intact && mapped.size - offset >= 8) {
+		uint32 wordCount = (uint32)readLittleEndian(bytes + offset, 4);
+		uint32 checksum = (uint32)readLittleEndian(bytes + offset + 4, 4);
+		offset += 8;
+		if (wordCount == 0) {
+			*finished = true;
+			break;
+		}
+		if ((mapped.size - offset) / 4 < wordCount || fnv1a(bytes + offset, (size_t)wordCount * 4) != checksum) {
+			break;
+		}
+		for (uint32 i=0; i<wordCount; ++i) {
+			PackedInput packed = (PackedInput)readLittleEndian(bytes + offset + i*4, 4);
+			if (packed >> 24 == packedFrameEscape) {
+				frame += packed & 0xFFFFFF;
+			}
+			else {
+				frame += packed >> 24;
+				// Past what a recording can hold, so the rest can't be right either
+				if (frame > maxRecordingFrame || !appendPackedInput(recording, (uint32)frame, packed & 0xFFFFFF)) {
+					intact = false;
+					break;
+				}
+			}
+		}
+		offset += (size_t)wordCount * 4;
+	}
+	unmapFile(&mapped);
+	return recording->inputCount > 0;
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include <stdio.h>
+#include "KeyState.h"
+
+const uint keyNameSize = 32;
+
+// Every key's name, looked up once up front. Asking the backend can be slow (GetKeyNameText goes
+// through the keyboard layout), so the GUI only reads from here. version changes on every refresh
+// so anything built from the names knows to rebuild.
+struct KeyNames
+{
+	char names[512][keyNameSize];
+	uint version;
+};
+
+// Call again when the keyboard layout changes
+void refreshKeyNames(KeyNames* names, InputBackend* backend)
+{
+	for (uint index = 0; index < 512; ++index) {
+		names->names[index][0] = 0;
+		backend->keyName(backend->data, keyAtIndex(index), names->names[index], keyNameSize);
+	}
+	names->version += 1;
+}
+
+const char* keyToString(KeyNames* names, KeyInput key)
+{
+	return names->names[keyIndex(key)];
+}
+
+// Key binding button text, rebuilt only when the key or the key names change
+struct KeyLabel
+{
+	uint keyIndex;
+	uint namesVersion;
+	char text[64];
+};
+
+const char* keyLabel(KeyLabel* label, const char* prefix, KeyNames* names, KeyInput key)
+{
+	uint index = keyIndex(key);
+	if (label->namesVersion != names->version || label->keyIndex != index) {
+		snprintf(label->text, sizeof(label->text), "%s: %s", prefix, keyToString(names, key));
+		label->keyIndex = index;
+		label->namesVersion = names->version;
+	}
+	return label->text;
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include "Backend.h"
+
+// One bit per key: 256 scancodes, doubled for the extended (E0) keys.
+// Updated as keys are injected, so the held keys are known without looking back through the recording.
+struct KeyState
+{
+	uint64 bits[512 / 64];
+};
+
+uint keyIndex(KeyInput key)
+{
+	return (key.scancode & 0xFF) | (key.extended ? 0x100 : 0);
+}
+
+KeyInput keyAtIndex(uint index)
+{
+	KeyInput key = {0};
+	key.scancode = (unsigned short)(index & 0xFF);
+	key.extended = index >> 8;
+	return key;
+}
+
+bool isKeyDown(KeyState* state, KeyInput key)
+{
+	uint index = keyIndex(key);
+	return (state->bits[index / 64] >> (index % 64)) & 1;
+}
+
+void updateKeyState(KeyState* state, KeyInput key)
+{
+	uint index = keyIndex(key);
+	uint64 bit = 1ull << (index % 64);
+	if (key.type == KeyInput::press) state->bits[index / 64] |= bit;
+	else state->bits[index / 64] &= ~bit;
+}
+
+// Appends a release for every key that is down
+void appendKeyReleases(KeyState* state, DynamicArray<KeyInput>* out)
+{
+	for (uint word = 0; word < 512 / 64; ++word) {
+		if (state->bits[word] == 0) continue;
+		for (uint bit = 0; bit < 64; ++bit) {
+			if ((state->bits[word] >> bit) & 1) {
+				KeyInput release = keyAtIndex(word * 64 + bit);
+				release.type = KeyInput::release;
+				out->push_back(release);
+			}
+		}
+	}
+}
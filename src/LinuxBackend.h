@@ -0,0 +1,399 @@
+#pragma once
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <thread>
+#include <linux/input.h>
+#include <linux/uinput.h>
+#include "Backend.h"
+#include "Profiler.h"
+
+// Reads keyboards from /dev/input/event* and injects through a uinput device.
+// Needs read access to the event devices and write access to /dev/uinput (usually the "input" group or root).
+// Keyboards are read on a capture thread as events arrive and handed over through captureRing.
+struct LinuxBackend
+{
+	DynamicArray<int> keyboards;
+	int uinput;
+	int loopback; // The uinput keyboard's event device if it is read back, which is also in keyboards. Otherwise -1.
+	int stopPipe[2]; // Written to wake the capture thread up for shutdown
+	CaptureRing captureRing;
+	CaptureSignal keysCaptured;
+	std::thread captureThread;
+};
+
+// Evdev codes 1 to 88 are the same as set 1 scancodes. Extended keys have their own codes.
+struct ExtendedKey
+{
+	unsigned short evdevCode;
+	unsigned short scancode;
+	const char* name;
+};
+
+static const ExtendedKey extendedKeys[] = {
+	{KEY_KPENTER, 0x1C, "Num Enter"},
+	{KEY_RIGHTCTRL, 0x1D, "Right Ctrl"},
+	{KEY_KPSLASH, 0x35, "Num /"},
+	{KEY_SYSRQ, 0x37, "Prnt Scrn"},
+	{KEY_RIGHTALT, 0x38, "Right Alt"},
+	{KEY_HOME, 0x47, "Home"},
+	{KEY_UP, 0x48, "Up"},
+	{KEY_PAGEUP, 0x49, "Page Up"},
+	{KEY_LEFT, 0x4B, "Left"},
+	{KEY_RIGHT, 0x4D, "Right"},
+	{KEY_END, 0x4F, "End"},
+	{KEY_DOWN, 0x50, "Down"},
+	{KEY_PAGEDOWN, 0x51, "Page Down"},
+	{KEY_INSERT, 0x52, "Insert"},
+	{KEY_DELETE, 0x53, "Delete"},
+	{KEY_LEFTMETA, 0x5B, "Left Windows"},
+	{KEY_RIGHTMETA, 0x5C, "Right Windows"},
+	{KEY_COMPOSE, 0x5D, "Application"},
+};
+static const uint extendedKeyCount = sizeof(extendedKeys)/sizeof(extendedKeys[0]);
+
+// Indexed by scancode, matching what GetKeyNameText gives on a US layout
+static const char* scancodeNames[] = {
+	0, "Esc", "1", "2", "3", "4", "5", "6", "7", "8", "9", "0", "-", "=", "Backspace", "Tab",
+	"Q", "W", "E", "R", "T", "Y", "U", "I", "O", "P", "[", "]", "Enter", "Ctrl", "A", "S",
+	"D", "F", "G", "H", "J", "K", "L", ";", "'", "`", "Shift", "\\", "Z", "X", "C", "V",
+	"B", "N", "M", ",", ".", "/", "Right Shift", "Num *", "Alt", "Space", "Caps Lock", "F1", "F2", "F3", "F4", "F5",
+	"F6", "F7", "F8", "F9", "F10", "Pause", "Scroll Lock", "Num 7", "Num 8", "Num 9", "Num -", "Num 4", "Num 5", "Num 6", "Num +", "Num 1",
+	"Num 2", "Num 3", "Num 0", "Num Del", 0, 0, "\\", "F11", "F12",
+};
+static const uint scancodeNameCount = sizeof(scancodeNames)/sizeof(scancodeNames[0]);
+
+bool keyFromEvdevCode(unsigned short code, KeyInput* key)
+{
+	if (code >= 1 && code <= KEY_F12) {
+		key->scancode = code;
+		key->extended = 0;
+		return true;
+	}
+	for (uint i=0; i<extendedKeyCount; ++i) {
+		if (extendedKeys[i].evdevCode == code) {
+			key->scancode = extendedKeys[i].scancode;
+			key->extended = 1;
+			return true;
+		}
+	}
+	return false;
+}
+
+// Returns 0 for keys that have no evdev equivalent
+unsigned short evdevCodeFromKey(KeyInput key)
+{
+	if (!key.extended) {
+		return (key.scancode >= 1 && key.scancode <= KEY_F12) ? key.scancode : 0;
+	}
+	for (uint i=0; i<extendedKeyCount; ++i) {
+		if (extendedKeys[i].scancode == key.scancode) {
+			return extendedKeys[i].evdevCode;
+		}
+	}
+	return 0;
+}
+
+bool isKeyboardDevice(int fd)
+{
+	unsigned long eventBits = 0;
+	unsigned char keyBits[KEY_MAX/8 + 1] = {0};
+	if (ioctl(fd, EVIOCGBIT(0, sizeof(eventBits)), &eventBits) < 0) return false;
+	if (!(eventBits & (1 << EV_KEY))) return false;
+	if (ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(keyBits)), keyBits) < 0) return false;
+	// Mice and gamepads also report EV_KEY, so look for a letter key
+	return (keyBits[KEY_A/8] & (1 << (KEY_A%8))) != 0;
+}
+
+void readKeyboard(LinuxBackend* backend, int fd)
+{
+	input_event events[64];
+	ssize_t bytesRead;
+	while ((bytesRead = read(fd, events, sizeof(events))) > 0) {
+		uint eventCount = (uint)(bytesRead / sizeof(input_event));
+		for (uint e=0; e<eventCount; ++e) {
+			if (events[e].type != EV_KEY) continue;
+			KeyInput key = {0};
+			if (!keyFromEvdevCode(events[e].code, &key)) continue;
+			// Auto-repeat (value 2) is reported as another press, the same as raw input on Windows
+			key.type = events[e].value == 0 ? KeyInput::release : KeyInput::press;
+			// Stamped by the kernel when the device reported it, on CLOCK_MONOTONIC (see initLinuxBackend)
+			key.time = (uint64)events[e].input_event_sec*1000000000ull + (uint64)events[e].input_event_usec*1000ull;
+			backend->captureRing.push(key);
+		}
+	}
+}
+
+void runCaptureThread(LinuxBackend* backend)
+{
+	sched_param param = {0};
+	param.sched_priority = sched_get_priority_min(SCHED_FIFO) + 20;
+	pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+	PROFILE_THREAD("Capture");
+
+	DynamicArray<pollfd> fds = {0};
+	for (uint i=0; i<backend->keyboards.count; ++i) {
+		pollfd fd = {backend->keyboards[i], POLLIN, 0};
+		fds.push_back(fd);
+	}
+	pollfd stopFd = {backend->stopPipe[0], POLLIN, 0};
+	fds.push_back(stopFd);
+
+	while (true) {
+		if (poll(fds.data, fds.count, -1) < 0) {
+			if (errno == EINTR) continue;
+			break;
+		}
+		if (fds.last().revents) break;
+		PROFILE_ZONE("Read keyboards");
+		bool readKeys = false;
+		for (uint i=0; i<fds.count - 1; ) {
+			short revents = fds[i].revents;
+			if (revents & POLLIN) {
+				readKeyboard(backend, fds[i].fd);
+				readKeys = true;
+			}
+			if (revents & (POLLERR | POLLHUP | POLLNVAL)) {
+				// Unplugged. It would report this on every poll from now on, so stop polling it.
+				// keyboards is only looked at again after this thread has been joined.
+				for (uint k=0; k<backend->keyboards.count; ++k) {
+					if (backend->keyboards[k] == fds[i].fd) backend->keyboards[k] = -1;
+				}
+				if (!(revents & POLLNVAL)) close(fds[i].fd);
+				fds.remove(i);
+				continue;
+			}
+			++i;
+		}
+		if (readKeys) signalCapture(&backend->keysCaptured);
+	}
+	fds.freeMemory();
+}
+
+void linuxCaptureKeys(void* data, DynamicArray<KeyInput>* out)
+{
+	LinuxBackend* backend = (LinuxBackend*)data;
+	drainCaptureRing(&backend->captureRing, out);
+}
+
+uint32 linuxGetDroppedKeyCount(void* data)
+{
+	LinuxBackend* backend = (LinuxBackend*)data;
+	return backend->captureRing.overflows();
+}
+
+void linuxInjectKeys(void* data, const KeyInput* keys, uint count)
+{
+	LinuxBackend* backend = (LinuxBackend*)data;
+	if (backend->uinput < 0) return;
+
+	// One write per batch with a single SYN_REPORT at the end, so readers see all the keys in the same report
+	input_event events[65];
+	uint eventCount = 0;
+	memset(events, 0, sizeof(events));
+	for (uint i=0; i<count; ++i) {
+		unsigned short code = evdevCodeFromKey(keys[i]);
+		if (code == 0) continue;
+		events[eventCount].type = EV_KEY;
+		events[eventCount].code = code;
+		events[eventCount].value = keys[i].type == KeyInput::press ? 1 : 0;
+		++eventCount;
+		if (eventCount == 64 && i+1 < count) {
+			// Flush huge batches without a SYN_REPORT. The report ends with the last write.
+			write(backend->uinput, events, eventCount * sizeof(input_event));
+			memset(events, 0, sizeof(events));
+			eventCount = 0;
+		}
+	}
+	if (eventCount == 0) return;
+	events[eventCount].type = EV_SYN;
+	events[eventCount].code = SYN_REPORT;
+	events[eventCount].value = 0;
+	++eventCount;
+	write(backend->uinput, events, eventCount * sizeof(input_event));
+}
+
+uint64 linuxGetTime(void* data)
+{
+	(void)data;
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64)now.tv_sec*1000000000ull + (uint64)now.tv_nsec;
+}
+
+void linuxSleepUntil(void* data, uint64 time)
+{
+	(void)data;
+	timespec deadline;
+	deadline.tv_sec = (time_t)(time / 1000000000ull);
+	deadline.tv_nsec = (long)(time % 1000000000ull);
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, 0) == EINTR) {}
+}
+
+void linuxWaitForKeys(void* data)
+{
+	LinuxBackend* backend = (LinuxBackend*)data;
+	waitForCapture(&backend->keysCaptured);
+}
+
+void linuxWakeUp(void* data)
+{
+	LinuxBackend* backend = (LinuxBackend*)data;
+	signalCapture(&backend->keysCaptured);
+}
+
+void linuxRaiseThreadPriority(void* data)
+{
+	(void)data;
+	// Real-time scheduling needs CAP_SYS_NICE or an rtprio limit. Fall back to a better nice value.
+	sched_param param = {0};
+	param.sched_priority = sched_get_priority_min(SCHED_FIFO) + 10;
+	if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0) {
+		setpriority(PRIO_PROCESS, 0, -10);
+	}
+}
+
+void linuxKeyName(void* data, KeyInput key, char* name, uint size)
+{
+	(void)data;
+	const char* known = 0;
+	if (key.extended) {
+		for (uint i=0; i<extendedKeyCount; ++i) {
+			if (extendedKeys[i].scancode == key.scancode) known = extendedKeys[i].name;
+		}
+	}
+	else if (key.scancode < scancodeNameCount) {
+		known = scancodeNames[key.scancode];
+	}
+	if (known) snprintf(name, size, "%s", known);
+	else snprintf(name, size, "Key 0x%02X", key.scancode);
+}
+
+int createUinputKeyboard()
+{
+	int fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK);
+	if (fd < 0) return -1;
+
+	ioctl(fd, UI_SET_EVBIT, EV_KEY);
+	ioctl(fd, UI_SET_EVBIT, EV_SYN);
+	for (int code=1; code<=KEY_F12; ++code) {
+		ioctl(fd, UI_SET_KEYBIT, code);
+	}
+	for (uint i=0; i<extendedKeyCount; ++i) {
+		ioctl(fd, UI_SET_KEYBIT, extendedKeys[i].evdevCode);
+	}
+
+	uinput_setup setup;
+	memset(&setup, 0, sizeof(setup));
+	setup.id.bustype = BUS_VIRTUAL;
+	strcpy(setup.name, "Keyboard Recorder");
+	if (ioctl(fd, UI_DEV_SETUP, &setup) < 0 || ioctl(fd, UI_DEV_CREATE) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+// Opens the event device of the uinput keyboard, so injected keys can be read back.
+// udev creates the device node shortly after the device, so this waits up to a second for it.
+int openUinputEvents(int uinput)
+{
+	char sysName[64];
+	if (ioctl(uinput, UI_GET_SYSNAME(sizeof(sysName)), sysName) < 0) return -1;
+	char sysPath[128];
+	snprintf(sysPath, sizeof(sysPath), "/sys/devices/virtual/input/%s", sysName);
+	for (int attempt=0; attempt<100; ++attempt) {
+		int fd = -1;
+		if (DIR* dir = opendir(sysPath)) {
+			while (dirent* entry = readdir(dir)) {
+				if (strncmp(entry->d_name, "event", 5) != 0) continue;
+				char path[300];
+				snprintf(path, sizeof(path), "/dev/input/%s", entry->d_name);
+				fd = open(path, O_RDONLY | O_NONBLOCK);
+				break;
+			}
+			closedir(dir);
+		}
+		if (fd >= 0) return fd;
+		usleep(10000);
+	}
+	return -1;
+}
+
+// Returns false if no keyboard could be opened. Injection is silently disabled if uinput is unavailable.
+// With loopback, keys injected are captured back like any other keyboard's, for verifying playback.
+bool initLinuxBackend(InputBackend* backend, LinuxBackend* linuxBackend, bool loopback)
+{
+	linuxBackend->keyboards = DynamicArray<int>();
+	linuxBackend->captureRing.clear();
+	// Open keyboards before creating the virtual device so injected keys are not captured back
+	if (DIR* dir = opendir("/dev/input")) {
+		while (dirent* entry = readdir(dir)) {
+			if (strncmp(entry->d_name, "event", 5) != 0) continue;
+			char path[300];
+			snprintf(path, sizeof(path), "/dev/input/%s", entry->d_name);
+			int fd = open(path, O_RDONLY | O_NONBLOCK);
+			if (fd < 0) continue;
+			if (isKeyboardDevice(fd)) {
+				// Event timestamps default to wall clock time, which can jump
+				int clock = CLOCK_MONOTONIC;
+				ioctl(fd, EVIOCSCLOCKID, &clock);
+				linuxBackend->keyboards.push_back(fd);
+			}
+			else close(fd);
+		}
+		closedir(dir);
+	}
+	if (linuxBackend->keyboards.count == 0) return false;
+	linuxBackend->uinput = createUinputKeyboard();
+	linuxBackend->loopback = -1;
+	if (loopback && linuxBackend->uinput >= 0) {
+		linuxBackend->loopback = openUinputEvents(linuxBackend->uinput);
+		if (linuxBackend->loopback >= 0) {
+			int clock = CLOCK_MONOTONIC;
+			ioctl(linuxBackend->loopback, EVIOCSCLOCKID, &clock);
+			linuxBackend->keyboards.push_back(linuxBackend->loopback);
+		}
+	}
+	if (pipe(linuxBackend->stopPipe) < 0) return false;
+	linuxBackend->captureThread = std::thread(runCaptureThread, linuxBackend);
+
+	backend->data = linuxBackend;
+	backend->captureKeys = linuxCaptureKeys;
+	backend->getDroppedKeyCount = linuxGetDroppedKeyCount;
+	backend->injectKeys = linuxInjectKeys;
+	backend->getTime = linuxGetTime;
+	backend->sleepUntil = linuxSleepUntil;
+	backend->waitForKeys = linuxWaitForKeys;
+	backend->wakeUp = linuxWakeUp;
+	backend->raiseThreadPriority = linuxRaiseThreadPriority;
+	backend->keyName = linuxKeyName;
+	return true;
+}
+
+void shutdownLinuxBackend(LinuxBackend* linuxBackend)
+{
+	if (linuxBackend->captureThread.joinable()) {
+		char stop = 0;
+		write(linuxBackend->stopPipe[1], &stop, 1);
+		linuxBackend->captureThread.join();
+		close(linuxBackend->stopPipe[0]);
+		close(linuxBackend->stopPipe[1]);
+	}
+	for (uint i=0; i<linuxBackend->keyboards.count; ++i) {
+		if (linuxBackend->keyboards[i] >= 0) close(linuxBackend->keyboards[i]);
+	}
+	linuxBackend->keyboards.freeMemory();
+	if (linuxBackend->uinput >= 0) {
+		ioctl(linuxBackend->uinput, UI_DEV_DESTROY);
+		close(linuxBackend->uinput);
+	}
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <stddef.h>
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// Read-only view of a whole file. Pages are read from disk as they are first touched.
+// The view stays valid after the file is closed, until unmapFile. Nothing may truncate the file meanwhile.
+struct MappedFile
+{
+	const unsigned char* bytes;
+	size_t size;
+};
+
+// An empty file maps to no bytes and still succeeds
+bool mapFile(MappedFile* mapped, const char* path)
+{
+	mapped->bytes = 0;
+	mapped->size = 0;
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+	if (file == INVALID_HANDLE_VALUE) return false;
+	LARGE_INTEGER size;
+	bool result = GetFileSizeEx(file, &size) != 0;
+	if (result && size.QuadPart > 0) {
+		HANDLE mapping = CreateFileMappingA(file, 0, PAGE_READONLY, 0, 0, 0);
+		if (mapping) {
+			mapped->bytes = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+			if (mapped->bytes) mapped->size = (size_t)size.QuadPart;
+			CloseHandle(mapping);
+		}
+		result = mapped->bytes != 0;
+	}
+	CloseHandle(file);
+	return result;
+#else
+	int file = open(path, O_RDONLY);
+	if (file < 0) return false;
+	struct stat info;
+	bool result = fstat(file, &info) == 0;
+	if (result && info.st_size > 0) {
+		void* bytes = mmap(0, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+		if (bytes != MAP_FAILED) {
+			mapped->bytes = (const unsigned char*)bytes;
+			mapped->size = (size_t)info.st_size;
+		}
+		result = mapped->bytes != 0;
+	}
+	close(file);
+	return result;
+#endif
+}
+
+void unmapFile(MappedFile* mapped)
+{
+	if (mapped->bytes) {
+#ifdef _WIN32
+		UnmapViewOfFile(mapped->bytes);
+#else
+		munmap((void*)mapped->bytes, mapped->size);
+#endif
+	}
+	mapped->bytes = 0;
+	mapped->size = 0;
+}
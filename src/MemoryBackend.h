@@ -0,0 +1,96 @@
+#pragma once
+#include <stdio.h>
+#include "Backend.h"
+
+// Backend that never touches the OS. Captured keys come from a script, injected keys are logged,
+// and time only moves when someone sleeps, so runs are fully deterministic.
+struct MemoryBackend
+{
+	DynamicArray<KeyInput> pendingKeys;  // Delivered on the next capture
+	DynamicArray<KeyInput> injectedKeys; // Everything the recorder sent
+	uint injectCallCount;
+	uint64 time;
+	bool loopback; // Injected keys are captured back too, stamped with the time they were injected
+};
+
+void memoryCaptureKeys(void* data, DynamicArray<KeyInput>* out)
+{
+	MemoryBackend* backend = (MemoryBackend*)data;
+	for (uint i=0; i<backend->pendingKeys.count; ++i) {
+		out->push_back(backend->pendingKeys[i]);
+	}
+	backend->pendingKeys.clear();
+}
+
+uint32 memoryGetDroppedKeyCount(void* data)
+{
+	return 0;
+}
+
+void memoryInjectKeys(void* data, const KeyInput* keys, uint count)
+{
+	MemoryBackend* backend = (MemoryBackend*)data;
+	for (uint i=0; i<count; ++i) {
+		backend->injectedKeys.push_back(keys[i]);
+		if (backend->loopback) {
+			KeyInput key = keys[i];
+			key.time = backend->time;
+			backend->pendingKeys.push_back(key);
+		}
+	}
+	backend->injectCallCount += 1;
+}
+
+uint64 memoryGetTime(void* data)
+{
+	return ((MemoryBackend*)data)->time;
+}
+
+void memorySleepUntil(void* data, uint64 time)
+{
+	MemoryBackend* backend = (MemoryBackend*)data;
+	if (time > backend->time) backend->time = time;
+}
+
+// Nothing else can capture keys while the only thread waits, so there's nothing to wait for
+void memoryWaitForKeys(void* data)
+{
+}
+
+void memoryWakeUp(void* data)
+{
+}
+
+void memoryRaiseThreadPriority(void* data)
+{
+}
+
+void memoryKeyName(void* data, KeyInput key, char* name, uint size)
+{
+	snprintf(name, size, "%s0x%02X", key.extended ? "E0 " : "", key.scancode);
+}
+
+void initMemoryBackend(InputBackend* backend, MemoryBackend* memory)
+{
+	*memory = {0};
+	backend->data = memory;
+	backend->captureKeys = memoryCaptureKeys;
+	backend->getDroppedKeyCount = memoryGetDroppedKeyCount;
+	backend->injectKeys = memoryInjectKeys;
+	backend->getTime = memoryGetTime;
+	backend->sleepUntil = memorySleepUntil;
+	backend->waitForKeys = memoryWaitForKeys;
+	backend->wakeUp = memoryWakeUp;
+	backend->raiseThreadPriority = memoryRaiseThreadPriority;
+	backend->keyName = memoryKeyName;
+}
+
+// Script a key event to be captured on the next frame
+void queueKey(MemoryBackend* memory, unsigned short scancode, KeyInput::Type type)
+{
+	KeyInput key = {0};
+	key.scancode = scancode;
+	key.type = type;
+	key.time = memory->time;
+	memory->pendingKeys.push_back(key);
+}
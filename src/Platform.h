@@ -1,15 +1,13 @@
 #include <Windows.h>
 #include <gl/GL.h>
 #include <wingdi.h>
-#include <stdint.h>
-#include <string>
-#include "DynamicArray.h"
+#include <mmsystem.h>
+#include "Backend.h"
+#include "Profiler.h"
 
-typedef int32_t int32;
-typedef int64_t int64;
-typedef unsigned int uint;
-typedef uint32_t uint32;
-typedef uint64_t uint64;
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
 
 struct Window
 {
@@ -18,13 +16,15 @@ struct Window
 	uint height;
 };
 
-struct KeyInput
+// Backend state. Raw input is read on its own capture thread as soon as it arrives
+// and handed to the recorder thread through captureRing.
+struct Win32Backend
 {
-	enum Type { press, release };
-
-	unsigned short scancode;
-	unsigned int extended;
-	Type type;
+	CaptureRing captureRing;
+	CaptureSignal keysCaptured;
+	HANDLE captureThread;
+	HANDLE sleepTimer;
+	LARGE_INTEGER frequency;
 };
 
 struct WindowInput
@@ -42,30 +42,21 @@ struct WindowInput
 
 	bool quit;
 	bool resized;
-	DynamicArray<KeyInput> keyEvents;
+	bool keyboardLayoutChanged; // Key names need looking up again
 	Mouse mouse;
 };
 
 LRESULT CALLBACK WindowProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
 {
 	WindowInput* input = (WindowInput*)GetProp(hwnd, TEXT("messages"));
-	if (msg == WM_INPUT) {
-		RAWINPUT raw;
-		unsigned int size = sizeof(RAWINPUT);
-		GetRawInputData((HRAWINPUT)lParam, RID_INPUT, &raw, &size, sizeof(RAWINPUTHEADER));
-		KeyInput key = {0};
-		key.scancode = raw.data.keyboard.MakeCode;
-		key.extended = raw.data.keyboard.Flags & RI_KEY_E0;
-		if (raw.data.keyboard.Flags & RI_KEY_BREAK) key.type = KeyInput::release;
-		
-		// 0x45 is an extra code that's generated from numpad keys and not needed.
-		if (key.scancode != 0x45) input->keyEvents.push_back(key);
-	}
 	if (msg == WM_DESTROY) {
 		input->quit = true;
 		PostQuitMessage(0);
 		return 0;
 	}
+	if (msg == WM_INPUTLANGCHANGE && input) {
+		input->keyboardLayoutChanged = true;
+	}
 
 	return DefWindowProc(hwnd, msg, wParam, lParam);
 }
@@ -126,14 +117,6 @@ void createWindow(Window* window, uint width, uint height)
 	// Turn on VSync
 	BOOL(__stdcall *wglSwapIntervalEXT)(int interval) = (BOOL(__stdcall*)(int)) wglGetProcAddress("wglSwapIntervalEXT");
 	wglSwapIntervalEXT(1);
-
-	// Setup RawInput. Gets keyboard messages even when the window is not focused.
-	RAWINPUTDEVICE rid;
-	rid.usUsagePage = 0x01;
-	rid.usUsage = 0x06;
-	rid.dwFlags = RIDEV_INPUTSINK;
-	rid.hwndTarget = window->hwnd;
-	RegisterRawInputDevices(&rid, 1, sizeof(RAWINPUTDEVICE));
 }
 
 void updateButton(WindowInput::Button* inout_button, unsigned int isDown)
@@ -154,7 +137,7 @@ void updateWindowInput(Window* win, WindowInput* input, bool waitForMessages)
 {
 	input->quit = false;
 	input->resized = false;
-	input->keyEvents.clear();
+	input->keyboardLayoutChanged = false;
 
 	SetProp(win->hwnd, TEXT("messages"), input);
 	MSG msg;
@@ -196,6 +179,28 @@ void swapBuffers(Window* window)
 	ReleaseDC(window->hwnd, deviceContext);
 }
 
+// Wakes up a thread blocked in updateWindowInput
+void wakeWindow(void* window)
+{
+	PostMessage(((Window*)window)->hwnd, WM_NULL, 0, 0);
+}
+
+// Wakes updateWindowInput every milliseconds with a WM_TIMER message, or stops if it's 0
+void setWindowTimer(Window* window, uint milliseconds)
+{
+	if (milliseconds) SetTimer(window->hwnd, 1, milliseconds, NULL);
+	else KillTimer(window->hwnd, 1);
+}
+
+// Falls back to 60 Hz if the driver doesn't say
+uint getRefreshRate(Window* window)
+{
+	HDC deviceContext = GetDC(window->hwnd);
+	int refreshRate = GetDeviceCaps(deviceContext, VREFRESH);
+	ReleaseDC(window->hwnd, deviceContext);
+	return refreshRate > 1 ? (uint)refreshRate : 60;
+}
+
 void setWindowTitle(Window* window, const char* string)
 {
 	SetWindowTextA(window->hwnd, string);
@@ -215,50 +220,203 @@ int getWindowHeight(Window window)
 	return (int)windowClientRect.bottom;
 }
 
-void simulateInput(KeyInput input)
+uint64 win32GetTime(void* data)
 {
-	INPUT simulatedKey = { 0 };
-	simulatedKey.type = INPUT_KEYBOARD;
-	simulatedKey.ki.wScan = input.scancode;
-	simulatedKey.ki.dwFlags |= KEYEVENTF_SCANCODE;
-	if (input.extended) simulatedKey.ki.dwFlags |= KEYEVENTF_EXTENDEDKEY;
-	if (input.type == KeyInput::release) simulatedKey.ki.dwFlags |= KEYEVENTF_KEYUP;
-
-	SendInput(1, &simulatedKey, sizeof(INPUT));
+	Win32Backend* backend = (Win32Backend*)data;
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+	uint64 seconds = counter.QuadPart / backend->frequency.QuadPart;
+	uint64 remainder = counter.QuadPart % backend->frequency.QuadPart;
+	return seconds*1000000000ull + remainder*1000000000ull / backend->frequency.QuadPart;
 }
 
-std::string keyToString(KeyInput key)
+LRESULT CALLBACK CaptureWindowProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
+{
+	Win32Backend* backend = (Win32Backend*)GetWindowLongPtr(hwnd, GWLP_USERDATA);
+	if (msg == WM_INPUT && backend) {
+		uint64 arrivalTime = win32GetTime(backend);
+		RAWINPUT raw;
+		unsigned int size = sizeof(RAWINPUT);
+		GetRawInputData((HRAWINPUT)lParam, RID_INPUT, &raw, &size, sizeof(RAWINPUTHEADER));
+		KeyInput key = {0};
+		key.scancode = raw.data.keyboard.MakeCode;
+		key.extended = raw.data.keyboard.Flags & RI_KEY_E0;
+		if (raw.data.keyboard.Flags & RI_KEY_BREAK) key.type = KeyInput::release;
+		key.time = arrivalTime;
+		
+		// 0x45 is an extra code that's generated from numpad keys and not needed.
+		if (key.scancode != 0x45) {
+			backend->captureRing.push(key);
+			signalCapture(&backend->keysCaptured);
+		}
+	}
+
+	return DefWindowProc(hwnd, msg, wParam, lParam);
+}
+
+DWORD WINAPI runCaptureThread(void* param)
+{
+	Win32Backend* backend = (Win32Backend*)param;
+	SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_HIGHEST);
+	PROFILE_THREAD("Capture");
+
+	// A message-only window gives raw input somewhere to go without touching the GUI thread
+	HINSTANCE hInstance = GetModuleHandle(0);
+	WNDCLASS wnd = {};
+	wnd.hInstance = hInstance;
+	wnd.lpfnWndProc = CaptureWindowProc;
+	wnd.lpszClassName = "GoblinCaptureWindowClass";
+	RegisterClass(&wnd);
+	HWND hwnd = CreateWindowEx(0, wnd.lpszClassName, NULL, 0, 0, 0, 0, 0, HWND_MESSAGE, 0, hInstance, 0);
+	SetWindowLongPtr(hwnd, GWLP_USERDATA, (LONG_PTR)backend);
+
+	// Setup RawInput. Gets keyboard messages even when the window is not focused.
+	RAWINPUTDEVICE rid;
+	rid.usUsagePage = 0x01;
+	rid.usUsage = 0x06;
+	rid.dwFlags = RIDEV_INPUTSINK;
+	rid.hwndTarget = hwnd;
+	RegisterRawInputDevices(&rid, 1, sizeof(RAWINPUTDEVICE));
+
+	MSG msg;
+	while (GetMessage(&msg, NULL, 0, 0) > 0) {
+		PROFILE_ZONE("Raw input");
+		DispatchMessage(&msg);
+	}
+	DestroyWindow(hwnd);
+	return 0;
+}
+
+void win32CaptureKeys(void* data, DynamicArray<KeyInput>* out)
+{
+	Win32Backend* backend = (Win32Backend*)data;
+	drainCaptureRing(&backend->captureRing, out);
+}
+
+uint32 win32GetDroppedKeyCount(void* data)
+{
+	Win32Backend* backend = (Win32Backend*)data;
+	return backend->captureRing.overflows();
+}
+
+void win32InjectKeys(void* data, const KeyInput* keys, uint count)
+{
+	// One SendInput call per batch so the keys are inserted into the input stream together
+	INPUT simulatedKeys[64];
+	while (count > 0) {
+		uint batchCount = count < 64 ? count : 64;
+		for (uint i=0; i<batchCount; ++i) {
+			INPUT simulatedKey = { 0 };
+			simulatedKey.type = INPUT_KEYBOARD;
+			simulatedKey.ki.wScan = keys[i].scancode;
+			simulatedKey.ki.dwFlags |= KEYEVENTF_SCANCODE;
+			if (keys[i].extended) simulatedKey.ki.dwFlags |= KEYEVENTF_EXTENDEDKEY;
+			if (keys[i].type == KeyInput::release) simulatedKey.ki.dwFlags |= KEYEVENTF_KEYUP;
+			simulatedKeys[i] = simulatedKey;
+		}
+		SendInput(batchCount, simulatedKeys, sizeof(INPUT));
+		keys += batchCount;
+		count -= batchCount;
+	}
+}
+
+void win32SleepUntil(void* data, uint64 time)
+{
+	Win32Backend* backend = (Win32Backend*)data;
+	uint64 now = win32GetTime(data);
+	if (time <= now) return;
+	if (backend->sleepTimer) {
+		// Negative due times are relative, in 100ns units
+		LARGE_INTEGER dueTime;
+		dueTime.QuadPart = -(LONGLONG)((time - now) / 100);
+		SetWaitableTimer(backend->sleepTimer, &dueTime, 0, 0, 0, FALSE);
+		WaitForSingleObject(backend->sleepTimer, INFINITE);
+	}
+	else {
+		Sleep((DWORD)((time - now) / 1000000));
+	}
+}
+
+void win32WaitForKeys(void* data)
+{
+	Win32Backend* backend = (Win32Backend*)data;
+	waitForCapture(&backend->keysCaptured);
+}
+
+void win32WakeUp(void* data)
+{
+	Win32Backend* backend = (Win32Backend*)data;
+	signalCapture(&backend->keysCaptured);
+}
+
+void win32RaiseThreadPriority(void* data)
+{
+	SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL);
+}
+
+void win32KeyName(void* data, KeyInput key, char* name, uint size)
 {
 	uint extendedKeysFlag = 0;
 	if (key.extended) {
 		extendedKeysFlag = 1 << 24;
 	}
 	LONG fullScancode = (key.scancode<<16) | extendedKeysFlag;
-	char buffer[64];
-	int result = GetKeyNameTextA(fullScancode, buffer, 64);
-	return buffer;
+	if (GetKeyNameTextA(fullScancode, name, (int)size) == 0) {
+		snprintf(name, size, "%sKey 0x%02X", key.extended ? "E0 " : "", key.scancode);
+	}
+}
+
+void initWin32Backend(InputBackend* backend, Win32Backend* win32)
+{
+	win32->captureRing.clear();
+	QueryPerformanceFrequency(&win32->frequency);
+	// High resolution timers need Windows 10 1803. Older versions fall back to Sleep,
+	// which is made accurate to a millisecond instead of the default 15.6ms. That raises the
+	// system timer rate for as long as the process runs, so it's only done when needed.
+	win32->sleepTimer = CreateWaitableTimerExW(0, 0, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+	if (!win32->sleepTimer) timeBeginPeriod(1);
+	win32->captureThread = CreateThread(0, 0, runCaptureThread, win32, 0, 0);
+
+	backend->data = win32;
+	backend->captureKeys = win32CaptureKeys;
+	backend->getDroppedKeyCount = win32GetDroppedKeyCount;
+	backend->injectKeys = win32InjectKeys;
+	backend->getTime = win32GetTime;
+	backend->sleepUntil = win32SleepUntil;
+	backend->waitForKeys = win32WaitForKeys;
+	backend->wakeUp = win32WakeUp;
+	backend->raiseThreadPriority = win32RaiseThreadPriority;
+	backend->keyName = win32KeyName;
 }
 
-FILE* openFileFromSaveDialog()
+// path must hold MAX_PATH characters
+bool pathFromSaveDialog(char* path)
 {
-	char path[MAX_PATH] = {0};
+	path[0] = 0;
 	OPENFILENAMEA ofn = {sizeof(OPENFILENAMEA)};
 	ofn.lpstrFilter = "Recording (.rec)\0*.rec\0\0";
 	ofn.lpstrDefExt = "rec";
 	ofn.lpstrFile = path;
 	ofn.nMaxFile = MAX_PATH;
-	if (GetSaveFileNameA(&ofn)) return fopen(path, "w");
-	return 0;
+	return GetSaveFileNameA(&ofn) != 0;
+}
+
+// path must hold MAX_PATH characters
+void pathNextToExecutable(char* path, const char* fileName)
+{
+	DWORD length = GetModuleFileNameA(0, path, MAX_PATH);
+	while (length > 0 && path[length-1] != '\\' && path[length-1] != '/') --length;
+	snprintf(path + length, MAX_PATH - length, "%s", fileName);
 }
 
-FILE* openFileFromLoadDialog()
+// path must hold MAX_PATH characters
+bool pathFromLoadDialog(char* path)
 {
-	char path[MAX_PATH] = {0};
+	path[0] = 0;
 	OPENFILENAMEA ofn = {sizeof(OPENFILENAMEA)};
 	ofn.lpstrFilter = "Recording (.rec)\0*.rec\0\0";
 	ofn.lpstrDefExt = "rec";
 	ofn.lpstrFile = path;
 	ofn.nMaxFile = MAX_PATH;
-	if (GetOpenFileNameA(&ofn)) return fopen(path, "r");
-	return 0;
+	return GetOpenFileNameA(&ofn) != 0;
 }
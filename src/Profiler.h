@@ -0,0 +1,140 @@
+#pragma once
+#include "Backend.h"
+
+// Scoped timing zones, for finding out where a frame's time goes. They only exist in builds with
+// PROFILE defined (-DPROFILE, or /DPROFILE for cl). Otherwise the macros compile to nothing.
+//
+//   PROFILE_THREAD("Recorder");      names the calling thread in the trace
+//   { PROFILE_ZONE("Render"); ... }  times the rest of the scope
+//   PROFILE_WRITE_TRACE(path);       writes everything recorded so far as a Chrome trace
+//
+// Each thread writes the zones it closes into its own ring, which keeps the last 64K of them,
+// so a zone costs two clock reads and a few stores, with no locks or allocation. The trace opens
+// in chrome://tracing or ui.perfetto.dev.
+#ifdef PROFILE
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+
+const uint profileRingSize = 1 << 16;
+
+struct ProfileEvent
+{
+	const char* name; // Must be a literal, or live until the trace is written
+	uint64 start;
+	uint64 end;
+};
+
+struct ProfileRing
+{
+	ProfileEvent events[profileRingSize];
+	std::atomic<uint64> count; // Events ever written. The newest is at (count - 1) % profileRingSize.
+	const char* threadName;
+	uint32 threadId;
+	ProfileRing* next;
+};
+
+// Rings are never freed, so a thread that has exited still shows up in the trace
+struct Profiler
+{
+	std::mutex lock; // Only taken when a thread writes its first zone and when writing the trace
+	ProfileRing* rings;
+	uint32 threadCount;
+};
+
+static Profiler profiler;
+static thread_local ProfileRing* threadProfileRing;
+
+uint64 profileTime()
+{
+	return (uint64)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+ProfileRing* currentProfileRing()
+{
+	if (!threadProfileRing) {
+		ProfileRing* ring = new ProfileRing();
+		std::lock_guard<std::mutex> guard(profiler.lock);
+		ring->threadId = ++profiler.threadCount;
+		ring->next = profiler.rings;
+		profiler.rings = ring;
+		threadProfileRing = ring;
+	}
+	return threadProfileRing;
+}
+
+void nameProfileThread(const char* name)
+{
+	currentProfileRing()->threadName = name;
+}
+
+struct ProfileZone
+{
+	const char* name;
+	uint64 start;
+
+	ProfileZone(const char* zoneName) : name(zoneName), start(profileTime()) {}
+
+	~ProfileZone() {
+		ProfileRing* ring = currentProfileRing();
+		uint64 count = ring->count.load(std::memory_order_relaxed);
+		ProfileEvent* event = &ring->events[count & (profileRingSize - 1)];
+		event->name = name;
+		event->start = start;
+		event->end = profileTime();
+		ring->count.store(count + 1, std::memory_order_release);
+	}
+};
+
+// Can be called while other threads are still recording. Their newest events may be missing, and
+// the oldest may be overwritten as they are written out. Returns false if the file couldn't be written.
+bool writeProfileTrace(const char* path)
+{
+	FILE* file = fopen(path, "wb");
+	if (!file) return false;
+	std::lock_guard<std::mutex> guard(profiler.lock);
+	uint64 origin = UINT64_MAX;
+	for (ProfileRing* ring = profiler.rings; ring; ring = ring->next) {
+		uint64 count = ring->count.load(std::memory_order_acquire);
+		uint64 first = count > profileRingSize ? count - profileRingSize : 0;
+		if (count > first && ring->events[first & (profileRingSize - 1)].start < origin) {
+			origin = ring->events[first & (profileRingSize - 1)].start;
+		}
+	}
+
+	// Complete events, with times in microseconds from the first one
+	fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+	bool firstEvent = true;
+	for (ProfileRing* ring = profiler.rings; ring; ring = ring->next) {
+		if (ring->threadName) {
+			fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+				firstEvent ? "" : ",\n", ring->threadId, ring->threadName);
+			firstEvent = false;
+		}
+		uint64 count = ring->count.load(std::memory_order_acquire);
+		uint64 first = count > profileRingSize ? count - profileRingSize : 0;
+		for (uint64 i = first; i < count; ++i) {
+			ProfileEvent event = ring->events[i & (profileRingSize - 1)];
+			if (event.start < origin || event.end < event.start) continue;
+			fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+				firstEvent ? "" : ",\n", event.name, ring->threadId, (event.start - origin) / 1000.0, (event.end - event.start) / 1000.0);
+			firstEvent = false;
+		}
+	}
+	fprintf(file, "\n]}\n");
+	bool written = ferror(file) == 0;
+	fclose(file);
+	return written;
+}
+
+#define PROFILE_CONCAT2(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT2(a, b)
+#define PROFILE_ZONE(name) ProfileZone PROFILE_CONCAT(profileZone, __LINE__)(name)
+#define PROFILE_THREAD(name) nameProfileThread(name)
+#define PROFILE_WRITE_TRACE(path) writeProfileTrace(path)
+#else
+#define PROFILE_ZONE(name)
+#define PROFILE_THREAD(name)
+#define PROFILE_WRITE_TRACE(path)
+#endif
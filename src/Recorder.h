@@ -0,0 +1,636 @@
+#pragma once
+#include "Backend.h"
+#include "FrameClock.h"
+#include "Histogram.h"
+#include "KeyState.h"
+#include "MappedFile.h"
+#include "Profiler.h"
+#include "Replay.h"
+#include "SegmentedArray.h"
+
+enum Mode {
+	Mode_idle,
+	Mode_recording,
+	Mode_playback,
+	Mode_waitingForRecordKey,
+	Mode_waitingForPlaybackKey,
+	Mode_waitingForStopKey,
+	Mode_waitingForReplayKey
+};
+
+enum PlaybackSpeed {
+	PlaybackSpeed_normal,
+	PlaybackSpeed_trimStartup,
+	PlaybackSpeed_fast
+};
+
+// Frame timing injects on the first frame boundary at or after the recorded frame, like a game polling input.
+// Exact timing injects at the recorded time offset, between frames if needed.
+enum PlaybackTiming {
+	PlaybackTiming_frame,
+	PlaybackTiming_exact
+};
+
+struct RecordedInput
+{
+	KeyInput key;
+	uint32 frame;
+	uint64 time; // Nanoseconds since the recording started. The frame is derived from this.
+};
+
+// Recorded inputs are packed into 32 bits each:
+//   bits 0-8   key, the scancode plus 0x100 for extended keys
+//   bit 9      set for a release
+//   bits 10-23 time since the start of the frame, in 1/16384ths of a frame
+//   bits 24-31 frames since the previous input
+// A gap of 255 frames or more is preceded by escape words, which have 255 in the top bits
+// and add their low 24 bits to the frame.
+typedef uint32 PackedInput;
+const uint32 packedFrameEscape = 255;
+const uint32 packedTimeSteps = 1 << 14;
+
+// A position in a recording, and the frame of the input before it that the next delta counts from
+struct RecordingCursor
+{
+	uint position;
+	uint32 frame;
+};
+
+// frameIndex has an entry every this many frames, so it stays small and seeking scans at most this many frames of inputs
+const uint32 frameIndexStride = 64;
+
+struct Recording
+{
+	// Segmented so appending never moves events, and other threads can read them while recording continues.
+	// See catchUpToPublished.
+	SegmentedArray<PackedInput, 14> events;
+	// frameIndex[i] points at the first input on or after frame i*frameIndexStride, so seeking doesn't have to scan
+	// from the start. Frames past the end of the index have no inputs left.
+	SegmentedArray<RecordingCursor, 10> frameIndex;
+	FrameClock clock;     // Rate the recording was made at, to turn frames and offsets back into times
+	RecordingCursor end;  // Where the next input goes
+	uint64 endTime;
+	uint inputCount;
+	// If a file is mapped, events and frameIndex point into it and are read only
+	MappedFile mapping;
+};
+
+// Last frame an input can be on, as far as the frame index reaches
+const uint32 maxRecordingFrame = SegmentedArray<RecordingCursor, 10>::capacity * frameIndexStride - 1;
+
+void releaseMapping(Recording* recording)
+{
+	if (recording->mapping.bytes) {
+		unmapFile(&recording->mapping);
+		recording->events.freeMemory();
+		recording->frameIndex.freeMemory();
+	}
+}
+
+// Starts an empty recording at clock's frame rate
+void clearRecording(Recording* recording, FrameClock* clock)
+{
+	releaseMapping(recording);
+	recording->events.clear();
+	recording->frameIndex.clear();
+	// Allocated up front so a copy of the struct taken now can follow what is appended later
+	if (!recording->events.table) recording->events.allocateTable();
+	if (!recording->frameIndex.table) recording->frameIndex.allocateTable();
+	recording->clock = *clock;
+	recording->end = {0};
+	recording->endTime = 0;
+	recording->inputCount = 0;
+}
+
+void freeRecording(Recording* recording)
+{
+	releaseMapping(recording);
+	recording->events.freeMemory();
+	recording->frameIndex.freeMemory();
+}
+
+// The copy is always in memory, even if recording is mapped
+Recording copyRecording(Recording* recording)
+{
+	Recording result = *recording;
+	result.events = recording->events.deepCopy();
+	result.frameIndex = recording->frameIndex.deepCopy();
+	result.mapping = {0};
+	return result;
+}
+
+// Appends an input given its frame and the low 24 bits of its packed form (key, type and time).
+// frame must not be before the end of the recording. Returns false without appending anything if
+// frame is past maxRecordingFrame or the recording is full.
+bool appendPackedInput(Recording* recording, uint32 frame, uint32 fields)
+{
+	uint32 delta = frame - recording->end.frame;
+	// At most one escape per 0xFFFFFF frames skipped, plus one for the rest, plus the input
+	if (frame > maxRecordingFrame || recording->events.capacity - recording->events.count < delta / 0xFFFFFF + 2) {
+		return false;
+	}
+	while (recording->frameIndex.count * frameIndexStride <= frame) {
+		if (!recording->frameIndex.push_back(recording->end)) return false;
+	}
+
+	while (delta >= packedFrameEscape) {
+		uint32 gap = delta < 0xFFFFFF ? delta : 0xFFFFFF;
+		if (!recording->events.push_back((packedFrameEscape << 24) | gap)) return false;
+		delta -= gap;
+	}
+	if (!recording->events.push_back(fields | (delta << 24))) return false;
+	recording->end.position = recording->events.count;
+	recording->end.frame = frame;
+	recording->inputCount += 1;
+	return true;
+}
+
+// Inputs must be appended in time order. Earlier ones, e.g. from another keyboard whose events
+// arrived slightly out of order, are moved up to the end of the recording. Returns false if it
+// doesn't fit, as appendPackedInput.
+bool appendInput(Recording* recording, RecordedInput input)
+{
+	if (input.frame < recording->end.frame) input.frame = recording->end.frame;
+	if (input.time < recording->endTime) input.time = recording->endTime;
+
+	// Times outside the input's frame only happen if the frame came from a file recorded at another rate
+	uint64 frameStart = timeAtFrame(&recording->clock, input.frame);
+	uint64 frameLength = timeAtFrame(&recording->clock, input.frame + 1) - frameStart;
+	uint64 offset = 0;
+	if (input.time >= frameStart + frameLength) offset = packedTimeSteps - 1;
+	else if (input.time > frameStart) offset = (input.time - frameStart) * packedTimeSteps / frameLength;
+
+	uint32 fields = keyIndex(input.key) | (input.key.type == KeyInput::release ? 1 << 9 : 0) | (uint32)(offset << 10);
+	if (!appendPackedInput(recording, input.frame, fields)) return false;
+	recording->endTime = input.time;
+	return true;
+}
+
+// Unpacks the input at cursor and moves cursor past it. Returns false at the end of the recording.
+bool readInput(Recording* recording, RecordingCursor* cursor, RecordedInput* input)
+{
+	uint position = cursor->position;
+	uint32 frame = cursor->frame;
+	while (position < recording->events.count) {
+		PackedInput packed = recording->events.element(position++);
+		if (packed >> 24 == packedFrameEscape) {
+			frame += packed & 0xFFFFFF;
+			continue;
+		}
+		frame += packed >> 24;
+
+		input->key = keyAtIndex(packed & 0x1FF);
+		input->key.type = (packed >> 9) & 1 ? KeyInput::release : KeyInput::press;
+		input->frame = frame;
+		uint64 frameStart = timeAtFrame(&recording->clock, frame);
+		uint64 frameLength = timeAtFrame(&recording->clock, frame + 1) - frameStart;
+		// Rounded up so packing the unpacked time gives the same bits back
+		uint64 offset = (packed >> 10) & (packedTimeSteps - 1);
+		input->time = frameStart + (offset * frameLength + packedTimeSteps - 1) / packedTimeSteps;
+		input->key.time = 0;
+		cursor->position = position;
+		cursor->frame = frame;
+		return true;
+	}
+	return false;
+}
+
+// Extends recording, a copy of the struct taken while its owner held the lock, to the inputs the owner has
+// appended and published since. It only reads, so it can run without the lock while recording continues,
+// as long as the recording isn't cleared or freed meanwhile.
+void catchUpToPublished(Recording* recording)
+{
+	uint published = recording->events.publishedCount();
+	if (published <= recording->events.count) return;
+	recording->events.count = published;
+	RecordingCursor cursor = recording->end;
+	RecordedInput input;
+	while (readInput(recording, &cursor, &input)) {
+		recording->end = cursor;
+		recording->endTime = input.time;
+		recording->inputCount += 1;
+	}
+	// Escapes are published before the input after them. Index entries up to the last input's frame
+	// were pushed before its event, so they're published too.
+	recording->events.count = recording->end.position;
+	if (recording->inputCount > 0) recording->frameIndex.count = recording->end.frame / frameIndexStride + 1;
+}
+
+RecordingCursor firstInputAtFrame(Recording* recording, uint32 frame)
+{
+	uint32 entry = frame / frameIndexStride;
+	if (entry >= recording->frameIndex.count) return recording->end;
+	RecordingCursor cursor = recording->frameIndex[entry];
+	RecordingCursor next = cursor;
+	RecordedInput input;
+	while (readInput(recording, &next, &input) && input.frame < frame) {
+		cursor = next;
+	}
+	return cursor;
+}
+
+// Persistent data that needs to get passed around
+struct AppData
+{
+	InputBackend backend;
+	Recording recording;
+	Mode mode;
+	PlaybackSpeed playbackSpeed;
+	PlaybackTiming playbackTiming;
+	KeyInput startRecordingKey;
+	KeyInput playbackRecordingKey;
+	KeyInput stopPlaybackKey;
+	KeyInput saveReplayKey;
+	uint32 recordingFrameNumber;
+	uint32 playbackStartFrame; // Where playback starts and loops back to
+	FrameClock clock;
+	uint64 recordingStartTime; // When the record key was pressed
+	uint64 playbackStartTime;  // When the playback key was pressed, minus any trimmed startup
+	uint64 frameDeadline;      // Deadline of the frame boundary that passed most recently
+	RecordingCursor playbackCursor; // Next input to play
+	KeyState heldKeys; // Keys playback has pressed and not yet released
+	// Reused every frame so playback doesn't allocate. Keys played on schedule carry the time they were due.
+	DynamicArray<KeyInput> injectBatch;
+	int enabled;
+	int loop;
+	int windowActive; // Key bindings are only taken from keys pressed while the GUI window has focus
+	// Instant replay. The buffer is optional and allocated once by the caller.
+	ReplayBuffer* replay;
+	int instantReplay;
+	uint64 replayWindow;      // How far back a saved replay goes, in nanoseconds
+	uint32 replaySaveCount;   // Goes up every time a replay becomes the recording
+	// Optional, allocated once by the caller. Other threads can read it at any time.
+	TimingStats* timing;
+	// While verifying, everything captured is also recorded into loopback, timed from the start of
+	// playback like the recording. See Verify.h.
+	int verifying;
+	Recording loopback;
+	uint64 verificationEndTime; // When verification playback ended, or UINT64_MAX while it's going
+	// Set while another thread copies recording without the lock, one thread at a time. Until then the
+	// recording is moved to retiredRecording rather than cleared or freed, and the copying thread frees it.
+	bool recordingPinned;
+	Recording retiredRecording;
+	uint32 recordingGeneration; // Goes up whenever recording is swapped for another one
+};
+
+bool sameKey(KeyInput a, KeyInput b)
+{
+	return a.scancode == b.scancode && a.extended == b.extended;
+}
+
+// Keys used for recording, playback and replays are left out of recordings
+bool isHotkey(AppData* data, KeyInput key)
+{
+	return sameKey(key, data->startRecordingKey) || sameKey(key, data->playbackRecordingKey) || sameKey(key, data->saveReplayKey);
+}
+
+// Appends keyEvents to recording, timed from startTime
+// Returns false if recording is full and inputs were left out
+bool recordInputs(AppData* data, DynamicArray<KeyInput> keyEvents, Recording* recording, uint64 startTime)
+{
+	PROFILE_ZONE("Record inputs");
+	uint64 now = data->timing ? getTime(&data->backend) : 0;
+	for (uint i=0; i<keyEvents.count; ++i)
+	{
+		KeyInput key = keyEvents[i];
+		if (!isHotkey(data, key))
+		{
+			if (data->timing) recordDuration(&data->timing->captureLatency, (int64)(now - key.time));
+			RecordedInput action = {0};
+			action.key = key;
+			action.time = key.time > startTime ? key.time - startTime : 0;
+			action.frame = frameAtTime(&data->clock, action.time);
+			if (!appendInput(recording, action)) return false;
+		}
+	}
+	return true;
+}
+
+// Same filtering as recordInputs, into the instant replay buffer. Doesn't allocate.
+void captureReplay(AppData* data, DynamicArray<KeyInput> keyEvents)
+{
+	if (!data->replay || !data->instantReplay) return;
+	for (uint i=0; i<keyEvents.count; ++i) {
+		if (!isHotkey(data, keyEvents[i])) {
+			pushReplayEvent(data->replay, keyEvents[i]);
+		}
+	}
+}
+
+// Lets go of the current recording before it's replaced. A pinned one is left for the thread copying it,
+// otherwise the caller can clear or free it.
+void retireRecording(AppData* data)
+{
+	++data->recordingGeneration;
+	if (data->recordingPinned) {
+		data->retiredRecording = data->recording;
+		data->recording = {0};
+		data->recordingPinned = false;
+	}
+}
+
+// Turns the replay window ending at endTime into the current recording, starting at its first input.
+// Releases of keys that were pressed before the window are dropped.
+void saveReplay(AppData* data, uint64 endTime)
+{
+	PROFILE_ZONE("Save replay");
+	ReplayBuffer* replay = data->replay;
+	uint64 windowStart = endTime > data->replayWindow ? endTime - data->replayWindow : 0;
+	uint32 first = 0;
+	while (first < replay->count && replayEventAt(replay, first)->time < windowStart) {
+		++first;
+	}
+
+	retireRecording(data);
+	clearRecording(&data->recording, &data->clock);
+	data->playbackStartFrame = 0;
+	KeyState held = {0};
+	uint64 startTime = 0;
+	for (uint32 i=first; i<replay->count; ++i) {
+		KeyInput key = replayEventKey(replayEventAt(replay, i));
+		if (key.time > endTime) break;
+		if (key.type == KeyInput::release && !isKeyDown(&held, key)) continue;
+		updateKeyState(&held, key);
+		if (data->recording.inputCount == 0) startTime = key.time;
+
+		RecordedInput action = {0};
+		action.key = key;
+		action.time = key.time - startTime;
+		action.frame = frameAtTime(&data->clock, action.time);
+		if (!appendInput(&data->recording, action)) break;
+	}
+	data->replaySaveCount += 1;
+}
+
+// Jumps playback to frame, as if playback had started at startTime from the beginning.
+// Keys held down across the seek point are not pressed.
+void seekPlayback(AppData* data, uint32 frame, uint64 startTime)
+{
+	data->recordingFrameNumber = frame;
+	data->playbackCursor = firstInputAtFrame(&data->recording, frame);
+	data->playbackStartTime = startTime - timeAtFrame(&data->clock, frame);
+}
+
+void flushInjectBatch(AppData* data)
+{
+	if (data->injectBatch.count > 0) {
+		PROFILE_ZONE("Inject keys");
+		for (uint i=0; i<data->injectBatch.count; ++i) {
+			updateKeyState(&data->heldKeys, data->injectBatch[i]);
+		}
+		injectKeys(&data->backend, data->injectBatch.data, data->injectBatch.count);
+		if (data->timing) {
+			uint64 now = getTime(&data->backend);
+			for (uint i=0; i<data->injectBatch.count; ++i) {
+				uint64 due = data->injectBatch[i].time;
+				if (due) recordDuration(&data->timing->injectionDelay, (int64)(now - due));
+			}
+		}
+		data->injectBatch.clear();
+	}
+}
+
+void playbackInputs(AppData* data)
+{
+	PROFILE_ZONE("Playback inputs");
+	// Everything due this frame goes out in one batch so simultaneous presses land in the same game poll
+	uint64 now = getTime(&data->backend);
+	data->injectBatch.clear();
+	RecordedInput input;
+	RecordingCursor next = data->playbackCursor;
+	while (readInput(&data->recording, &next, &input))
+	{
+		// If trimming startup, skip ahead to first input
+		if (data->playbackCursor.position == 0 && data->playbackSpeed == PlaybackSpeed_trimStartup)
+		{
+			data->recordingFrameNumber = input.frame;
+			data->playbackStartTime = now - input.time;
+		}
+
+		if (data->playbackSpeed == PlaybackSpeed_fast)
+		{
+			data->injectBatch.push_back(input.key);
+			data->playbackCursor = next;
+			flushInjectBatch(data);
+			return;
+		}
+
+		// Normal playback speed
+		bool due = data->playbackTiming == PlaybackTiming_exact
+			? data->playbackStartTime + input.time <= now
+			: input.frame <= data->recordingFrameNumber;
+		if (!due)
+		{
+			flushInjectBatch(data);
+			return;
+		}
+		// Frame timing is due on the frame boundary, not at the recorded offset
+		input.key.time = data->playbackTiming == PlaybackTiming_exact ? data->playbackStartTime + input.time : data->frameDeadline;
+		data->injectBatch.push_back(input.key);
+		data->playbackCursor = next;
+	}
+	flushInjectBatch(data);
+
+	// Reached the end. Verification only plays once.
+	if (data->loop && !data->verifying) {
+		seekPlayback(data, data->playbackStartFrame, now);
+	}
+	else {
+		data->mode = Mode_idle;
+	}
+}
+
+void releasePressedKeys(AppData* data)
+{
+	// If playback is cancelled, keys can get stuck down.
+	// Send key-up messages for the keys playback is still holding.
+	data->injectBatch.clear();
+	appendKeyReleases(&data->heldKeys, &data->injectBatch);
+	flushInjectBatch(data);
+}
+
+// Absolute time the next input is due in exact timing playback, or UINT64_MAX if nothing is waiting on time
+uint64 nextPlaybackTime(AppData* data)
+{
+	if (data->mode != Mode_playback || data->playbackTiming != PlaybackTiming_exact || data->playbackSpeed == PlaybackSpeed_fast) {
+		return UINT64_MAX;
+	}
+	RecordedInput input;
+	RecordingCursor next = data->playbackCursor;
+	if (!readInput(&data->recording, &next, &input)) {
+		return UINT64_MAX;
+	}
+	return data->playbackStartTime + input.time;
+}
+
+// Returns the first press of target, or null
+KeyInput* findKeyPress(DynamicArray<KeyInput> keys, KeyInput target)
+{
+	for (uint i = 0; i < keys.count; ++i) {
+		if (keys[i].type == KeyInput::press && keys[i].scancode == target.scancode && keys[i].extended == target.extended) {
+			return &keys[i];
+		}
+	}
+	return 0;
+}
+
+bool keyWasPressed(DynamicArray<KeyInput> keys, KeyInput target)
+{
+	return findKeyPress(keys, target) != 0;
+}
+
+// Times are taken from the hotkey press so recording and playback line up to when the key was hit,
+// not to when the recorder got around to seeing it.
+void startRecording(AppData* data, uint64 startTime)
+{
+	data->mode = Mode_recording;
+	data->recordingFrameNumber = 0;
+	data->recordingStartTime = startTime;
+	retireRecording(data);
+	clearRecording(&data->recording, &data->clock);
+}
+
+void startPlayback(AppData* data, uint64 startTime)
+{
+	data->mode = Mode_playback;
+	seekPlayback(data, data->playbackStartFrame, startTime);
+	if (data->verifying) clearRecording(&data->loopback, &data->clock);
+}
+
+void stopPlayback(AppData* data)
+{
+	data->mode = Mode_idle;
+	data->recordingFrameNumber = 0;
+	data->playbackCursor = {0};
+}
+
+// Takes ownership of recording. Stops playback or recording that is in progress.
+void replaceRecording(AppData* data, Recording recording)
+{
+	if (data->mode == Mode_playback) {
+		releasePressedKeys(data);
+	}
+	if (data->mode == Mode_playback || data->mode == Mode_recording) {
+		stopPlayback(data);
+	}
+	retireRecording(data);
+	freeRecording(&data->recording);
+	data->recording = recording;
+	data->playbackStartFrame = 0;
+}
+
+// Hotkey handling, key binding, recording and playback for one frame
+void updateRecorder(AppData* data, DynamicArray<KeyInput> keyEvents)
+{
+	if (data->mode == Mode_waitingForRecordKey) {
+		if (keyEvents.count > 0 && data->windowActive) {
+			data->startRecordingKey = keyEvents[0];
+			data->mode = Mode_idle;
+		}
+	}
+	else if (data->mode == Mode_waitingForPlaybackKey) {
+		if (keyEvents.count > 0 && data->windowActive) {
+			data->playbackRecordingKey = keyEvents[0];
+			data->mode = Mode_idle;
+		}
+	}
+	else if (data->mode == Mode_waitingForStopKey) {
+		if (keyEvents.count > 0 && data->windowActive) {
+			data->stopPlaybackKey = keyEvents[0];
+			data->mode = Mode_idle;
+		}
+	}
+	else if (data->mode == Mode_waitingForReplayKey) {
+		if (keyEvents.count > 0 && data->windowActive) {
+			data->saveReplayKey = keyEvents[0];
+			data->mode = Mode_idle;
+		}
+	}
+	else if (data->mode == Mode_idle && data->enabled) {
+		captureReplay(data, keyEvents);
+		if (KeyInput* key = findKeyPress(keyEvents, data->startRecordingKey)) {
+			startRecording(data, key->time);
+		}
+		if (KeyInput* key = findKeyPress(keyEvents, data->playbackRecordingKey)) {
+			startPlayback(data, key->time);
+		}
+		else if (data->replay && data->instantReplay) {
+			if (KeyInput* key = findKeyPress(keyEvents, data->saveReplayKey)) {
+				saveReplay(data, key->time);
+			}
+		}
+	}
+	else if (data->mode == Mode_recording) {
+		captureReplay(data, keyEvents);
+		if (keyWasPressed(keyEvents, data->startRecordingKey)) {
+			data->mode = Mode_idle;
+		}
+		else if (KeyInput* key = findKeyPress(keyEvents, data->playbackRecordingKey)) {
+			startPlayback(data, key->time);
+		}
+		// A full recording stops as if the record key was pressed
+		else if (!recordInputs(data, keyEvents, &data->recording, data->recordingStartTime)) {
+			data->mode = Mode_idle;
+		}
+	}
+	else if (data->mode == Mode_playback) {
+		if (!data->enabled) {
+			data->mode = Mode_idle;
+		}
+		else if (KeyInput* key = findKeyPress(keyEvents, data->startRecordingKey)) {
+			releasePressedKeys(data);
+			startRecording(data, key->time);
+		}
+		else if (KeyInput* key = findKeyPress(keyEvents, data->playbackRecordingKey)) {
+			releasePressedKeys(data);
+			startPlayback(data, key->time);
+		}
+		else if (keyWasPressed(keyEvents, data->stopPlaybackKey)) {
+			releasePressedKeys(data);
+			stopPlayback(data);
+		}
+		else {
+			playbackInputs(data);
+		}
+	}
+}
+
+// Only playback, and verification while it waits for the last keys to come back, needs to wake up every
+// frame. Everything else happens when keys arrive, and recorded keys get their frame from the time they
+// were captured.
+bool keepsFrames(AppData* data)
+{
+	return data->mode == Mode_playback || data->verifying;
+}
+
+// One wakeup of the recorder loop, given the keys captured at the start of it. frameEnded says whether
+// the frame deadline had passed before capturing. Returns when the loop should wake up next.
+uint64 stepRecorder(AppData* data, DynamicArray<KeyInput> keyEvents, bool frameEnded)
+{
+	PROFILE_ZONE("Update recorder");
+	if (frameEnded) {
+		data->frameDeadline = data->clock.nextFrameTime;
+		// Consecutive deadline errors give how much longer or shorter than the period the last frame was
+		if (data->timing) {
+			int64 periodError = data->clock.lastError - data->timing->previousFrameError;
+			if (data->clock.frameStreak >= 2) recordDuration(&data->timing->framePeriodError, periodError < 0 ? -periodError : periodError);
+			data->timing->previousFrameError = data->clock.lastError;
+		}
+	}
+	// Keeps going after playback ends, since the last keys played may not have come back yet
+	if (data->verifying) {
+		recordInputs(data, keyEvents, &data->loopback, data->playbackStartTime);
+	}
+	updateRecorder(data, keyEvents);
+	if (frameEnded) {
+		++data->recordingFrameNumber;
+		advanceFrame(&data->clock);
+	}
+	// Recording doesn't keep frames, so its frame number comes from the time
+	if (data->mode == Mode_recording) {
+		uint64 now = getTime(&data->backend);
+		data->recordingFrameNumber = frameAtTime(&data->clock, now > data->recordingStartTime ? now - data->recordingStartTime : 0);
+	}
+	uint64 wakeTime = nextPlaybackTime(data);
+	return wakeTime < data->clock.nextFrameTime ? wakeTime : data->clock.nextFrameTime;
+}
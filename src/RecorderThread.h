@@ -0,0 +1,241 @@
+#pragma once
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include "Journal.h"
+#include "Recorder.h"
+#include "Verify.h"
+
+// The part of AppData other threads get to see. The recorder thread publishes a copy after every frame.
+struct RecorderStatus
+{
+	Mode mode;
+	PlaybackSpeed playbackSpeed;
+	PlaybackTiming playbackTiming;
+	KeyInput startRecordingKey;
+	KeyInput playbackRecordingKey;
+	KeyInput stopPlaybackKey;
+	KeyInput saveReplayKey;
+	uint32 recordingFrameNumber;
+	uint64 rateNumerator;
+	uint64 rateDenominator;
+	uint recordingCount;
+	uint32 recordingFrameCount;
+	uint32 playbackStartFrame;
+	uint32 droppedKeyCount;
+	int64 lastFrameError;
+	int64 worstFrameError;
+	int64 averageFrameError;
+	int enabled;
+	int loop;
+	int windowActive;
+	int instantReplay;
+	uint32 replaySaveCount;
+	int verifying;
+	FidelityReport verification; // Report of the last verification to finish
+	uint32 verificationCount;    // Goes up every time a verification finishes
+};
+
+// Recording and playback run on their own high priority thread with their own frame deadlines,
+// so a slow GUI frame or a late buffer swap never delays injected keys. Only playback keeps frame
+// deadlines. Otherwise the thread sleeps until keys arrive or another thread wakes it.
+struct RecorderThread
+{
+	AppData data;          // Owned by the recorder thread. Other threads must hold lock.
+	RecorderStatus status; // Guarded by lock
+	std::mutex lock;
+	std::thread thread;
+	std::atomic<bool> quit;
+	// Called on the recorder thread after the mode changes, a replay is saved or a verification finishes,
+	// e.g. to wake up the GUI
+	void (*onModeChange)(void* user);
+	void* onModeChangeUser;
+	Journal* journal; // Optional. Recordings are journaled to disk as they are made.
+	// The last verification's report. The delays can be read at any time, once verificationCount says it finished.
+	FidelityReport verification; // Guarded by lock
+	uint32 verificationCount;    // Guarded by lock
+	Histogram verificationDelay;
+};
+
+void publishStatus(RecorderThread* recorder)
+{
+	AppData* data = &recorder->data;
+	RecorderStatus* status = &recorder->status;
+	status->mode = data->mode;
+	status->playbackSpeed = data->playbackSpeed;
+	status->playbackTiming = data->playbackTiming;
+	status->startRecordingKey = data->startRecordingKey;
+	status->playbackRecordingKey = data->playbackRecordingKey;
+	status->stopPlaybackKey = data->stopPlaybackKey;
+	status->saveReplayKey = data->saveReplayKey;
+	status->recordingFrameNumber = data->recordingFrameNumber;
+	status->rateNumerator = data->clock.rateNumerator;
+	status->rateDenominator = data->clock.rateDenominator;
+	status->recordingCount = data->recording.inputCount;
+	status->recordingFrameCount = data->recording.inputCount ? data->recording.end.frame + 1 : 0;
+	status->playbackStartFrame = data->playbackStartFrame;
+	status->droppedKeyCount = getDroppedKeyCount(&data->backend);
+	status->lastFrameError = data->clock.lastError;
+	status->worstFrameError = data->clock.worstError;
+	status->averageFrameError = averageFrameError(&data->clock);
+	status->enabled = data->enabled;
+	status->loop = data->loop;
+	status->windowActive = data->windowActive;
+	status->instantReplay = data->instantReplay;
+	status->replaySaveCount = data->replaySaveCount;
+	status->verifying = data->verifying;
+	status->verification = recorder->verification;
+	status->verificationCount = recorder->verificationCount;
+}
+
+void runRecorderThread(RecorderThread* recorder)
+{
+	AppData* data = &recorder->data;
+	raiseThreadPriority(&data->backend);
+	PROFILE_THREAD("Recorder");
+	DynamicArray<KeyInput> keyEvents = {0};
+
+	// Exact timing playback also wakes up between frames for each input that is due
+	FrameClock* clock = &data->clock;
+	startFrameClock(clock, getTime(&data->backend));
+	while (!recorder->quit)
+	{
+		bool frameEnded = getTime(&data->backend) >= clock->nextFrameTime;
+		keyEvents.clear();
+		{
+			PROFILE_ZONE("Capture keys");
+			captureKeys(&data->backend, &keyEvents);
+		}
+
+		{
+			PROFILE_ZONE("Recorder lock");
+			recorder->lock.lock();
+		}
+		Mode previousMode = data->mode;
+		uint32 previousReplaySaveCount = data->replaySaveCount;
+		uint64 wakeTime = stepRecorder(data, keyEvents, frameEnded);
+		bool verified = data->verifying && verificationDue(data, getTime(&data->backend));
+		if (verified) {
+			PROFILE_ZONE("Finish verification");
+			recorder->verification = finishVerification(data, &recorder->verificationDelay);
+			recorder->verificationCount += 1;
+		}
+		if (recorder->journal) {
+			PROFILE_ZONE("Update journal");
+			updateJournal(recorder->journal, data);
+		}
+		publishStatus(recorder);
+		bool modeChanged = data->mode != previousMode || data->replaySaveCount != previousReplaySaveCount || verified;
+		bool keepFrames = keepsFrames(data) || (recorder->journal && journalPending(recorder->journal));
+		recorder->lock.unlock();
+
+		if (modeChanged && recorder->onModeChange) {
+			recorder->onModeChange(recorder->onModeChangeUser);
+		}
+
+		if (keepFrames) {
+			PROFILE_ZONE("Wait for deadline");
+			waitForDeadline(clock, &data->backend, wakeTime);
+		}
+		else {
+			PROFILE_ZONE("Wait for keys");
+			waitForKeys(&data->backend);
+			resumeFrameClock(clock, getTime(&data->backend));
+		}
+	}
+
+	if (data->mode == Mode_playback) {
+		releasePressedKeys(data);
+	}
+	keyEvents.freeMemory();
+}
+
+// Fill in data.backend, data.clock and the key bindings before starting, and start the journal if there is one
+void startRecorderThread(RecorderThread* recorder)
+{
+	recorder->quit = false;
+	publishStatus(recorder);
+	recorder->thread = std::thread(runRecorderThread, recorder);
+}
+
+void stopRecorderThread(RecorderThread* recorder)
+{
+	recorder->quit = true;
+	wakeUp(&recorder->data.backend);
+	recorder->thread.join();
+}
+
+RecorderStatus getRecorderStatus(RecorderThread* recorder)
+{
+	std::lock_guard<std::mutex> guard(recorder->lock);
+	return recorder->status;
+}
+
+// Applies the fields that changed between before and after, e.g. from a GUI edit of a status copy.
+// The mode is only applied if the recorder hasn't changed it in the meantime.
+void applyStatusChanges(RecorderThread* recorder, RecorderStatus before, RecorderStatus after)
+{
+	std::lock_guard<std::mutex> guard(recorder->lock);
+	AppData* data = &recorder->data;
+	if (after.mode != before.mode && data->mode == before.mode) {
+		if (data->mode == Mode_playback) {
+			releasePressedKeys(data);
+		}
+		data->mode = after.mode;
+	}
+	if (after.playbackSpeed != before.playbackSpeed) data->playbackSpeed = after.playbackSpeed;
+	if (after.playbackTiming != before.playbackTiming) data->playbackTiming = after.playbackTiming;
+	if (after.rateNumerator != before.rateNumerator || after.rateDenominator != before.rateDenominator) {
+		setFrameRate(&data->clock, after.rateNumerator, after.rateDenominator);
+	}
+	if (after.playbackStartFrame != before.playbackStartFrame) data->playbackStartFrame = after.playbackStartFrame;
+	if (after.enabled != before.enabled) data->enabled = after.enabled;
+	if (after.loop != before.loop) data->loop = after.loop;
+	if (after.windowActive != before.windowActive) data->windowActive = after.windowActive;
+	if (after.instantReplay != before.instantReplay) {
+		data->instantReplay = after.instantReplay;
+		if (data->replay) clearReplay(data->replay);
+	}
+	publishStatus(recorder);
+}
+
+// Returns a copy the caller must free. The lock is only taken to pin the recording, so a new one can't
+// clear or free it meanwhile. The copy goes up to the published count, which takes in whatever was
+// recorded while it was being made, and doesn't hold up the recorder however long the recording is.
+Recording copyRecording(RecorderThread* recorder)
+{
+	Recording snapshot;
+	{
+		std::lock_guard<std::mutex> guard(recorder->lock);
+		snapshot = recorder->data.recording;
+		recorder->data.recordingPinned = true;
+	}
+	catchUpToPublished(&snapshot);
+	Recording copy = copyRecording(&snapshot);
+	{
+		std::lock_guard<std::mutex> guard(recorder->lock);
+		recorder->data.recordingPinned = false;
+		freeRecording(&recorder->data.retiredRecording);
+		recorder->data.retiredRecording = {0};
+	}
+	return copy;
+}
+
+// Takes ownership of recording. Stops playback or recording that is in progress.
+void replaceRecording(RecorderThread* recorder, Recording recording)
+{
+	std::lock_guard<std::mutex> guard(recorder->lock);
+	replaceRecording(&recorder->data, recording);
+	publishStatus(recorder);
+}
+
+// Plays the recording once and records what the backend captures back. The recorder thread finishes it
+// a little after playback ends, and getRecorderStatus then has the report and a new verificationCount.
+void startVerification(RecorderThread* recorder)
+{
+	std::lock_guard<std::mutex> guard(recorder->lock);
+	startVerification(&recorder->data, getTime(&recorder->data.backend));
+	publishStatus(recorder);
+	// The recorder may be asleep waiting for keys, and playback needs it keeping frames
+	wakeUp(&recorder->data.backend);
+}
@@ -0,0 +1,330 @@
+#pragma once
+#include <stdio.h>
+#include <string.h>
+#include "Recorder.h"
+
+// Binary recording format, version 3. All numbers are little endian.
+//   "KREC"           magic
+//   uint16           version
+//   uint16           reserved, 0
+//   uint64 uint64    frame rate numerator and denominator the recording was made at
+//   uint32           input count
+//   uint32           event count, the packed inputs plus escape words (see Recorder.h)
+//   uint32           frame index entry count
+//   uint32           frame of the last input
+//   uint32           FNV-1a checksum of the header before it
+//   uint32           reserved, 0
+//   uint32[]         packed events
+//   uint32[2][]      frame index, position and frame of each entry
+// The events and index use the in-memory packing, so a loaded recording plays straight from
+// a read-only mapping of the file. Only the header is checked up front. Checking the rest would read
+// every page, and bad event data can't make playback read out of bounds.
+//
+// Version 2 had the same header up to the input count, then per input a LEB128 varint of frames
+// since the previous input and the low 24 bits of the packed input, then an FNV-1a checksum of the file.
+// Version 1 was the text format, one "scancode extended type frame @time name" line per input.
+// The time field didn't exist in the first text recordings.
+const char recordingMagic[4] = {'K', 'R', 'E', 'C'};
+const uint32 recordingVersion = 3;
+const uint recordingHeaderSize = 48;
+const uint version2HeaderSize = 28;
+
+uint32 fnv1a(const unsigned char* bytes, size_t size)
+{
+	uint32 hash = 2166136261u;
+	for (size_t i=0; i<size; ++i) {
+		hash = (hash ^ bytes[i]) * 16777619u;
+	}
+	return hash;
+}
+
+unsigned char* writeLittleEndian(unsigned char* out, uint64 value, uint size)
+{
+	for (uint i=0; i<size; ++i) {
+		*out++ = (unsigned char)(value >> (i*8));
+	}
+	return out;
+}
+
+uint64 readLittleEndian(const unsigned char* in, uint size)
+{
+	uint64 value = 0;
+	for (uint i=0; i<size; ++i) {
+		value |= (uint64)in[i] << (i*8);
+	}
+	return value;
+}
+
+// The file should be opened in binary mode. Returns false if the write failed.
+bool writeRecording(Recording* recording, FILE* file)
+{
+	size_t size = recordingHeaderSize + (size_t)recording->events.count * 4 + (size_t)recording->frameIndex.count * 8;
+	unsigned char* buffer = (unsigned char*)malloc(size);
+	unsigned char* out = buffer;
+	memcpy(out, recordingMagic, 4);
+	out = writeLittleEndian(out + 4, recordingVersion, 2);
+	out = writeLittleEndian(out, 0, 2);
+	out = writeLittleEndian(out, recording->clock.rateNumerator, 8);
+	out = writeLittleEndian(out, recording->clock.rateDenominator, 8);
+	out = writeLittleEndian(out, recording->inputCount, 4);
+	out = writeLittleEndian(out, recording->events.count, 4);
+	out = writeLittleEndian(out, recording->frameIndex.count, 4);
+	out = writeLittleEndian(out, recording->end.frame, 4);
+	out = writeLittleEndian(out, fnv1a(buffer, out - buffer), 4);
+	out = writeLittleEndian(out, 0, 4);
+	for (uint i=0; i<recording->events.count; ++i) {
+		out = writeLittleEndian(out, recording->events[i], 4);
+	}
+	for (uint i=0; i<recording->frameIndex.count; ++i) {
+		out = writeLittleEndian(out, recording->frameIndex[i].position, 4);
+		out = writeLittleEndian(out, recording->frameIndex[i].frame, 4);
+	}
+
+	bool written = fwrite(buffer, 1, size, file) == size;
+	free(buffer);
+	return written;
+}
+
+// Writes to a temporary file next to path and moves it over path once it's complete, so a failed save
+// leaves the old file as it was, and a recording mapped from the old file can still read it.
+// Returns false if any step failed.
+bool saveRecordingFile(Recording* recording, const char* path)
+{
+	char temporaryPath[4096];
+	if (snprintf(temporaryPath, sizeof(temporaryPath), "%s.tmp", path) >= (int)sizeof(temporaryPath)) return false;
+	FILE* file = fopen(temporaryPath, "wb");
+	if (!file) return false;
+	bool saved = writeRecording(recording, file);
+	saved = fclose(file) == 0 && saved;
+#ifdef _WIN32
+	saved = saved && MoveFileExA(temporaryPath, path, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	saved = saved && rename(temporaryPath, path) == 0;
+#endif
+	if (!saved) remove(temporaryPath);
+	return saved;
+}
+
+bool validFrameRate(uint64 rateNumerator, uint64 rateDenominator)
+{
+	return rateNumerator != 0 && rateDenominator != 0 && rateNumerator < 1000000000ull && rateDenominator < 1000000000ull;
+}
+
+// Points recording at the events and index in the mapped file, without copying.
+// Takes ownership of the mapping if it succeeds.
+bool mapBinaryRecording(Recording* recording, MappedFile* mapped)
+{
+	const unsigned char* bytes = mapped->bytes;
+	if (mapped->size < recordingHeaderSize || readLittleEndian(bytes + 40, 4) != fnv1a(bytes, 40)) {
+		return false;
+	}
+	uint64 rateNumerator = readLittleEndian(bytes + 8, 8);
+	uint64 rateDenominator = readLittleEndian(bytes + 16, 8);
+	uint32 eventCount = (uint32)readLittleEndian(bytes + 28, 4);
+	uint32 indexCount = (uint32)readLittleEndian(bytes + 32, 4);
+	if (!validFrameRate(rateNumerator, rateDenominator)) {
+		return false;
+	}
+	if (mapped->size != recordingHeaderSize + (uint64)eventCount * 4 + (uint64)indexCount * 8) {
+		return false;
+	}
+	if (eventCount > recording->events.capacity || indexCount > recording->frameIndex.capacity) {
+		return false;
+	}
+
+	FrameClock clock;
+	initFrameClock(&clock, rateNumerator, rateDenominator, 0);
+	clearRecording(recording, &clock);
+	// Both platforms are little endian, so the file's words can be used as they are
+	if (!recording->events.referTo((PackedInput*)(bytes + recordingHeaderSize), eventCount) ||
+		!recording->frameIndex.referTo((RecordingCursor*)(bytes + recordingHeaderSize + (size_t)eventCount * 4), indexCount)) {
+		return false;
+	}
+	recording->inputCount = (uint32)readLittleEndian(bytes + 24, 4);
+	recording->end.position = eventCount;
+	recording->end.frame = (uint32)readLittleEndian(bytes + 36, 4);
+	recording->mapping = *mapped;
+	return true;
+}
+
+bool readVersion2Recording(Recording* recording, const unsigned char* bytes, size_t size)
+{
+	if (size < version2HeaderSize + 4) {
+		return false;
+	}
+	if (readLittleEndian(bytes + size - 4, 4) != fnv1a(bytes, size - 4)) {
+		return false;
+	}
+	uint64 rateNumerator = readLittleEndian(bytes + 8, 8);
+	uint64 rateDenominator = readLittleEndian(bytes + 16, 8);
+	uint32 inputCount = (uint32)readLittleEndian(bytes + 24, 4);
+	if (!validFrameRate(rateNumerator, rateDenominator)) {
+		return false;
+	}
+	// Every input takes at least 4 bytes
+	if (inputCount > (size - version2HeaderSize - 4) / 4) {
+		return false;
+	}
+
+	FrameClock clock;
+	initFrameClock(&clock, rateNumerator, rateDenominator, 0);
+	clearRecording(recording, &clock);
+	const unsigned char* in = bytes + version2HeaderSize;
+	const unsigned char* end = bytes + size - 4;
+	uint32 frame = 0;
+	for (uint32 i=0; i<inputCount; ++i) {
+		uint64 delta = 0;
+		for (uint shift = 0; ; shift += 7) {
+			if (in == end || shift > 28) return false;
+			delta |= (uint64)(*in & 0x7F) << shift;
+			if (!(*in++ & 0x80)) break;
+		}
+		if (end - in < 3 || delta > UINT32_MAX - frame) {
+			return false;
+		}
+		frame += (uint32)delta;
+		if (!appendPackedInput(recording, frame, (uint32)readLittleEndian(in, 3))) {
+			return false;
+		}
+		in += 3;
+	}
+	return in == end;
+}
+
+// Why a recording didn't load, for showing to the user
+struct LoadError
+{
+	const char* reason;
+	uint line; // Line of a text recording the reason applies to, or 0
+};
+
+// Reads an unsigned decimal number no bigger than max. Leaves in at the first character after it.
+bool parseNumber(const char** in, const char* end, uint64 max, uint64* value)
+{
+	const char* c = *in;
+	uint64 result = 0;
+	while (c < end && *c >= '0' && *c <= '9') {
+		uint digit = *c - '0';
+		if (digit > max || result > (max - digit) / 10) return false;
+		result = result * 10 + digit;
+		++c;
+	}
+	if (c == *in) return false;
+	*in = c;
+	*value = result;
+	return true;
+}
+
+bool isSpace(char c)
+{
+	return c == ' ' || c == '\t';
+}
+
+// Needs at least one space unless the line ends here
+bool skipSpaces(const char** in, const char* end)
+{
+	const char* c = *in;
+	while (c < end && isSpace(*c)) ++c;
+	bool skipped = c != *in || c == end || *c == '\r';
+	*in = c;
+	return skipped;
+}
+
+// Parses the whole file in place rather than line by line with sscanf, which was slow and let
+// garbage through as zeros. Blank lines are skipped and anything after the time is the key's name,
+// which is ignored. Lines without a time field get their times from clock.
+bool readTextRecording(Recording* recording, const char* text, size_t size, FrameClock* clock, LoadError* error)
+{
+	clearRecording(recording, clock);
+	const char* in = text;
+	const char* end = text + size;
+	uint line = 0;
+	while (in < end) {
+		++line;
+		const char* lineEnd = (const char*)memchr(in, '\n', end - in);
+		if (!lineEnd) lineEnd = end;
+		skipSpaces(&in, lineEnd);
+		if (in == lineEnd || *in == '\r') {
+			in = lineEnd + 1;
+			continue;
+		}
+
+		error->line = line;
+		uint64 scancode, extended, type, frame, time = 0;
+		if (!parseNumber(&in, lineEnd, 0xFF, &scancode) || !skipSpaces(&in, lineEnd)) {
+			error->reason = "Bad scancode";
+			return false;
+		}
+		// Older versions saved the raw RI_KEY_E0 bit, which is 2
+		if (!parseNumber(&in, lineEnd, UINT32_MAX, &extended) || !skipSpaces(&in, lineEnd)) {
+			error->reason = "Bad extended flag";
+			return false;
+		}
+		if (!parseNumber(&in, lineEnd, 1, &type) || !skipSpaces(&in, lineEnd)) {
+			error->reason = "Bad press or release";
+			return false;
+		}
+		if (!parseNumber(&in, lineEnd, UINT32_MAX, &frame) || !skipSpaces(&in, lineEnd)) {
+			error->reason = "Bad frame";
+			return false;
+		}
+		if (recording->inputCount > 0 && frame < recording->end.frame) {
+			error->reason = "Frame is before the previous input's";
+			return false;
+		}
+		if (frame > maxRecordingFrame) {
+			error->reason = "Frame is too far in for a recording";
+			return false;
+		}
+		// The key name can be "@" on some layouts, so a time needs a digit after it
+		bool hasTime = lineEnd - in >= 2 && in[0] == '@' && in[1] >= '0' && in[1] <= '9';
+		if (hasTime) {
+			++in;
+			if (!parseNumber(&in, lineEnd, UINT64_MAX, &time) || !skipSpaces(&in, lineEnd)) {
+				error->reason = "Bad time";
+				return false;
+			}
+		}
+
+		RecordedInput input = {0};
+		input.key.scancode = (unsigned short)scancode;
+		input.key.extended = extended ? 1 : 0;
+		input.key.type = type ? KeyInput::release : KeyInput::press;
+		input.frame = (uint32)frame;
+		input.time = hasTime ? time : timeAtFrame(clock, input.frame);
+		if (!appendInput(recording, input)) {
+			error->reason = "Too many inputs for a recording";
+			return false;
+		}
+		in = lineEnd + 1;
+	}
+	error->line = 0;
+	return true;
+}
+
+// Reads any version. Current binary recordings are mapped and play from the file without being
+// read in, so loading takes the same time however long they are. Older ones are converted in memory.
+// Text recordings use clock's frame rate. Returns false and fills in error if the file is unreadable or corrupt.
+bool loadRecordingFile(Recording* recording, const char* path, FrameClock* clock, LoadError* error)
+{
+	error->reason = "Damaged or from a newer version";
+	error->line = 0;
+	MappedFile mapped;
+	if (!mapFile(&mapped, path)) {
+		error->reason = "Can't be opened";
+		return false;
+	}
+	if (mapped.size >= 6 && memcmp(mapped.bytes, recordingMagic, 4) == 0) {
+		uint version = (uint)readLittleEndian(mapped.bytes + 4, 2);
+		if (version == recordingVersion && mapBinaryRecording(recording, &mapped)) {
+			return true;
+		}
+		bool result = version == 2 && readVersion2Recording(recording, mapped.bytes, mapped.size);
+		unmapFile(&mapped);
+		return result;
+	}
+
+	bool result = readTextRecording(recording, (const char*)mapped.bytes, mapped.size, clock, error);
+	unmapFile(&mapped);
+	return result;
+}
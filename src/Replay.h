@@ -0,0 +1,49 @@
+#pragma once
+#include "Backend.h"
+#include "KeyState.h"
+
+// Instant replay keeps the most recent key events in a fixed circular buffer, overwriting the oldest,
+// so memory stays flat however long it runs. 64K events is well over 5 minutes of constant mashing.
+const uint replayCapacity = 1 << 16;
+
+struct ReplayEvent
+{
+	uint64 time;  // Arrival time on the backend's clock
+	uint16_t key; // keyIndex, plus 0x200 for a release
+};
+
+struct ReplayBuffer
+{
+	ReplayEvent events[replayCapacity];
+	uint32 next;  // Where the next event goes
+	uint32 count;
+};
+
+void clearReplay(ReplayBuffer* replay)
+{
+	replay->next = 0;
+	replay->count = 0;
+}
+
+void pushReplayEvent(ReplayBuffer* replay, KeyInput key)
+{
+	ReplayEvent* event = &replay->events[replay->next];
+	event->time = key.time;
+	event->key = (uint16_t)(keyIndex(key) | (key.type == KeyInput::release ? 0x200 : 0));
+	replay->next = (replay->next + 1) & (replayCapacity - 1);
+	if (replay->count < replayCapacity) replay->count += 1;
+}
+
+// 0 is the oldest event
+ReplayEvent* replayEventAt(ReplayBuffer* replay, uint32 index)
+{
+	return &replay->events[(replay->next - replay->count + index) & (replayCapacity - 1)];
+}
+
+KeyInput replayEventKey(ReplayEvent* event)
+{
+	KeyInput key = keyAtIndex(event->key & 0x1FF);
+	key.type = event->key & 0x200 ? KeyInput::release : KeyInput::press;
+	key.time = event->time;
+	return key;
+}
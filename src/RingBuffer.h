@@ -0,0 +1,52 @@
+#pragma once
+#include <atomic>
+#include <stdint.h>
+
+// Fixed size lock-free queue for exactly one producer thread and one consumer thread.
+// Never allocates, and a full buffer drops the new item and counts it instead of blocking the producer.
+template <class T, unsigned int capacity> struct RingBuffer
+{
+	static_assert((capacity & (capacity - 1)) == 0, "RingBuffer capacity must be a power of two");
+
+	// Indices only ever increase and wrap naturally. Kept on separate cache lines so
+	// the producer and consumer don't fight over them.
+	alignas(64) std::atomic<uint32_t> writeIndex;
+	alignas(64) std::atomic<uint32_t> readIndex;
+	alignas(64) std::atomic<uint32_t> overflowCount;
+	T items[capacity];
+
+	void clear() {
+		writeIndex.store(0);
+		readIndex.store(0);
+		overflowCount.store(0);
+	}
+
+	// Producer thread only
+	bool push(T item) {
+		uint32_t write = writeIndex.load(std::memory_order_relaxed);
+		uint32_t read = readIndex.load(std::memory_order_acquire);
+		if (write - read == capacity) {
+			overflowCount.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+		items[write & (capacity - 1)] = item;
+		writeIndex.store(write + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Consumer thread only
+	bool pop(T* out) {
+		uint32_t read = readIndex.load(std::memory_order_relaxed);
+		uint32_t write = writeIndex.load(std::memory_order_acquire);
+		if (read == write) {
+			return false;
+		}
+		*out = items[read & (capacity - 1)];
+		readIndex.store(read + 1, std::memory_order_release);
+		return true;
+	}
+
+	uint32_t overflows() {
+		return overflowCount.load(std::memory_order_relaxed);
+	}
+};
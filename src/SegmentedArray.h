@@ -0,0 +1,110 @@
+#pragma once
+#include <atomic>
+#include <new>
+#include <string.h>
+#include "DynamicArray.h"
+
+// Growable array made of fixed-size segments that never move once allocated. Appending is O(1)
+// with no copying, and while one thread appends, other threads can read every element below
+// publishedCount() without a lock. Segments are only released by freeMemory, so a reader has to be
+// done before the array is freed. It holds at most maxSegments segments.
+template <class T, unsigned int segmentBits> struct SegmentedArray
+{
+	static const unsigned int segmentSize = 1u << segmentBits;
+	static const unsigned int maxSegments = 4096;
+
+	static const unsigned int capacity = maxSegments * segmentSize;
+
+	// Allocated on the first append and never moved, so readers can hold on to it
+	struct Table
+	{
+		std::atomic<unsigned int> publishedCount;
+		bool external; // Segments point into memory the array doesn't own, e.g. a mapped file
+		T* segments[maxSegments];
+	};
+
+	unsigned int count; // Owner's count. Readers use publishedCount().
+	Table* table;
+
+	void allocateTable() {
+		table = (Table*)calloc(1, sizeof(Table));
+		new (&table->publishedCount) std::atomic<unsigned int>(0);
+	}
+
+	// Returns false, leaving the array as it was, if it is full or external
+	bool push_back(T element) {
+		if (!table) allocateTable();
+		unsigned int segment = count >> segmentBits;
+		if (segment >= maxSegments || table->external) return false;
+		if (!table->segments[segment]) {
+			table->segments[segment] = (T*)malloc(segmentSize * sizeof(T));
+		}
+		table->segments[segment][count & (segmentSize - 1)] = element;
+		++count;
+		table->publishedCount.store(count, std::memory_order_release);
+		return true;
+	}
+
+	void clear() {
+		count = 0;
+		if (table) table->publishedCount.store(0, std::memory_order_release);
+	}
+
+	// Readers on other threads can use this once they have been handed the array after its table
+	// was allocated. Elements below it are fully written.
+	unsigned int publishedCount() {
+		return table ? table->publishedCount.load(std::memory_order_acquire) : 0;
+	}
+
+	T& element(unsigned int index) {
+		return table->segments[index >> segmentBits][index & (segmentSize - 1)];
+	}
+
+	// Uses size elements of contiguous memory owned by someone else, without copying them.
+	// The array can't be appended to until it is freed. Returns false, leaving the array empty,
+	// if size is more than it can hold.
+	bool referTo(T* data, unsigned int size) {
+		freeMemory();
+		if (size > capacity) return false;
+		allocateTable();
+		table->external = true;
+		for (unsigned int i = 0; i * segmentSize < size; ++i) {
+			table->segments[i] = data + i * segmentSize;
+		}
+		count = size;
+		table->publishedCount.store(count, std::memory_order_release);
+		return true;
+	}
+
+	SegmentedArray<T, segmentBits> deepCopy() {
+		SegmentedArray<T, segmentBits> result = {0};
+		for (unsigned int start = 0; start < count; start += segmentSize) {
+			unsigned int segment = start >> segmentBits;
+			unsigned int length = count - start < segmentSize ? count - start : segmentSize;
+			if (!result.table) result.allocateTable();
+			result.table->segments[segment] = (T*)malloc(segmentSize * sizeof(T));
+			memcpy(result.table->segments[segment], table->segments[segment], length * sizeof(T));
+		}
+		result.count = count;
+		if (result.table) result.table->publishedCount.store(count, std::memory_order_release);
+		return result;
+	}
+
+	void freeMemory() {
+		if (table) {
+			if (!table->external) {
+				for (unsigned int i = 0; i < maxSegments && table->segments[i]; ++i) {
+					free(table->segments[i]);
+				}
+			}
+			free(table);
+		}
+		table = 0;
+		count = 0;
+	}
+
+	T& operator[](unsigned int index) {
+		ASSERT(index < count, "SegmentedArray access out of range");
+		return table->segments[index >> segmentBits][index & (segmentSize - 1)];
+	}
+};
@@ -0,0 +1,162 @@
+#pragma once
+#include "MemoryBackend.h"
+#include "Recorder.h"
+
+// Runs the recorder loop the way the recorder thread does, but on the calling thread against a
+// MemoryBackend. Time only moves when the loop sleeps, so a run with the same script always makes the
+// same injections on the same frames, and nothing needs a window, a keyboard or real time.
+//
+// A script is a list of key events with arrival times on the virtual clock. Each step captures the
+// events that have arrived, exactly as a real backend would hand them over.
+//
+// When the recorder thread would sleep until keys arrive, the clock jumps to the next scripted key.
+// With none scripted it moves on to the next frame deadline instead, since the thread would sleep
+// forever and runs that count frames still have to end.
+
+struct Injection
+{
+	KeyInput key;
+	uint32 frame; // Frames since the simulation started
+	uint64 time;  // Virtual time it was injected at
+};
+
+struct Simulation
+{
+	AppData data;
+	MemoryBackend memory;
+	DynamicArray<KeyInput> script; // In time order
+	uint scriptPosition;
+	DynamicArray<KeyInput> keyEvents;
+	DynamicArray<Injection> injections; // Everything injected, unless logInjections is off
+	bool logInjections;
+	uint64 injectionCount;
+	uint32 frame;
+	uint64 stepCount;
+	uint64 idleWaitCount; // Steps that waited for keys rather than for a frame deadline
+};
+
+// The simulation starts at time 0 with F1 to F4 as the hotkeys, like the real front ends
+void initSimulation(Simulation* sim, uint64 rateNumerator, uint64 rateDenominator)
+{
+	*sim = {};
+	initMemoryBackend(&sim->data.backend, &sim->memory);
+	sim->data.startRecordingKey.scancode = 0x3B;
+	sim->data.playbackRecordingKey.scancode = 0x3C;
+	sim->data.stopPlaybackKey.scancode = 0x3D;
+	sim->data.saveReplayKey.scancode = 0x3E;
+	sim->data.enabled = true;
+	sim->logInjections = true;
+	// Nothing oversleeps a virtual clock, so there's no need to spin
+	initFrameClock(&sim->data.clock, rateNumerator, rateDenominator, 0);
+	startFrameClock(&sim->data.clock, 0);
+}
+
+void freeSimulation(Simulation* sim)
+{
+	freeRecording(&sim->data.recording);
+	freeRecording(&sim->data.loopback);
+	sim->data.injectBatch.freeMemory();
+	sim->memory.pendingKeys.freeMemory();
+	sim->memory.injectedKeys.freeMemory();
+	sim->script.freeMemory();
+	sim->keyEvents.freeMemory();
+	sim->injections.freeMemory();
+}
+
+// Events must be scripted in time order
+void scriptKey(Simulation* sim, uint64 time, unsigned short scancode, KeyInput::Type type)
+{
+	KeyInput key = {0};
+	key.scancode = scancode;
+	key.type = type;
+	key.time = time;
+	sim->script.push_back(key);
+}
+
+// Time a frame of the simulation starts at
+uint64 simulationFrameTime(Simulation* sim, uint32 frame)
+{
+	return timeAtFrame(&sim->data.clock, frame);
+}
+
+// Stands in for waitForKeys: moves the clock to when the next key arrives
+void waitForScriptedKeys(Simulation* sim, uint64 wakeTime)
+{
+	MemoryBackend* memory = &sim->memory;
+	if (memory->pendingKeys.count > 0) return;
+	if (sim->scriptPosition < sim->script.count) {
+		sleepUntil(&sim->data.backend, sim->script[sim->scriptPosition].time);
+	}
+	else {
+		sleepUntil(&sim->data.backend, wakeTime);
+	}
+}
+
+// One pass of the recorder loop: capture, update, then sleep until the next wakeup, or until keys
+// arrive if the recorder isn't keeping frames
+void stepSimulation(Simulation* sim)
+{
+	AppData* data = &sim->data;
+	MemoryBackend* memory = &sim->memory;
+	uint64 now = getTime(&data->backend);
+	while (sim->scriptPosition < sim->script.count && sim->script[sim->scriptPosition].time <= now) {
+		memory->pendingKeys.push_back(sim->script[sim->scriptPosition++]);
+	}
+	// So a script fed a frame at a time doesn't keep growing
+	if (sim->scriptPosition == sim->script.count) {
+		sim->script.clear();
+		sim->scriptPosition = 0;
+	}
+
+	bool frameEnded = now >= data->clock.nextFrameTime;
+	sim->keyEvents.clear();
+	captureKeys(&data->backend, &sim->keyEvents);
+	uint64 wakeTime = stepRecorder(data, sim->keyEvents, frameEnded);
+
+	sim->injectionCount += memory->injectedKeys.count;
+	if (sim->logInjections) {
+		for (uint i=0; i<memory->injectedKeys.count; ++i) {
+			Injection injection = {memory->injectedKeys[i], sim->frame, now};
+			sim->injections.push_back(injection);
+		}
+	}
+	memory->injectedKeys.clear();
+
+	if (frameEnded) ++sim->frame;
+	sim->stepCount += 1;
+	if (keepsFrames(data)) {
+		waitForDeadline(&data->clock, &data->backend, wakeTime);
+	}
+	else {
+		sim->idleWaitCount += 1;
+		waitForScriptedKeys(sim, wakeTime);
+		resumeFrameClock(&data->clock, getTime(&data->backend));
+	}
+}
+
+void runSimulationFrames(Simulation* sim, uint32 frames)
+{
+	uint32 start = sim->frame;
+	while (sim->frame - start < frames) {
+		stepSimulation(sim);
+	}
+}
+
+// Runs until every scripted key has been captured
+void runSimulationScript(Simulation* sim)
+{
+	while (sim->scriptPosition < sim->script.count) {
+		stepSimulation(sim);
+	}
+}
+
+// Runs until the recorder leaves mode, or frames run out. Returns false if it ran out.
+bool runSimulationWhile(Simulation* sim, Mode mode, uint32 frames)
+{
+	uint32 start = sim->frame;
+	while (sim->data.mode == mode) {
+		if (sim->frame - start >= frames) return false;
+		stepSimulation(sim);
+	}
+	return true;
+}
@@ -0,0 +1,156 @@
+#pragma once
+#include <stdio.h>
+#include "Recorder.h"
+
+// Loopback verification. The recording is played once from the start frame while everything the
+// capture path sees is recorded into AppData::loopback, then the two are lined up frame by frame.
+// The backend has to capture its own injected keys. Raw input on Windows already does. The Linux
+// backend reads its uinput device back when asked to, and MemoryBackend can loop back in memory.
+//
+// Each played input is paired with the next capture of the same key and type. A capture on an earlier
+// frame can't have come from it, so it counts as extra. One on a later frame than the next played
+// input of that key and type is left for that input, and this one counts as dropped.
+
+struct FidelityReport
+{
+	uint played;    // Inputs in the recording from the start frame on
+	uint captured;  // Inputs captured back
+	uint onTime;    // Captured on the frame they were recorded on
+	uint late;      // Captured on a later frame
+	uint dropped;   // Never captured
+	uint extra;     // Captured but never played, e.g. typing during verification
+	uint reordered; // Captured before an input that was played ahead of them
+	uint32 worstFrameLag;
+};
+
+// Percentage of played inputs that were captured on time
+double fidelity(FidelityReport* report)
+{
+	return report->played ? 100.0 * report->onTime / report->played : 100.0;
+}
+
+// Key and type, for chaining inputs of the same key and type together
+uint inputSlot(KeyInput key)
+{
+	return keyIndex(key) * 2 + (key.type == KeyInput::release ? 1 : 0);
+}
+
+const uint inputSlotCount = 1024;
+const uint noInput = 0xFFFFFFFF;
+
+// Reads the inputs from cursor on into inputs, and links each to the next of the same key and type in nextSame
+void readChainedInputs(Recording* recording, RecordingCursor cursor, DynamicArray<RecordedInput>* inputs, DynamicArray<uint>* nextSame, uint* firstSame)
+{
+	uint lastSame[inputSlotCount];
+	for (uint i=0; i<inputSlotCount; ++i) firstSame[i] = lastSame[i] = noInput;
+	RecordedInput input;
+	while (readInput(recording, &cursor, &input)) {
+		uint slot = inputSlot(input.key);
+		uint index = inputs->count;
+		inputs->push_back(input);
+		nextSame->push_back(noInput);
+		if (lastSame[slot] == noInput) firstSame[slot] = index;
+		else (*nextSame)[lastSame[slot]] = index;
+		lastSame[slot] = index;
+	}
+}
+
+// delay is optional, and is filled with how long after its recorded time each input was captured.
+// With frame timing that includes waiting for the frame boundary.
+FidelityReport compareLoopback(Recording* recording, uint32 startFrame, Recording* loopback, Histogram* delay)
+{
+	FidelityReport report = {0};
+	DynamicArray<RecordedInput> played = {0};
+	DynamicArray<uint> playedNext = {0};
+	DynamicArray<RecordedInput> captured = {0};
+	DynamicArray<uint> capturedNext = {0};
+	uint playedFirst[inputSlotCount];
+	uint capturedHead[inputSlotCount];
+	readChainedInputs(recording, firstInputAtFrame(recording, startFrame), &played, &playedNext, playedFirst);
+	RecordingCursor start = {0};
+	readChainedInputs(loopback, start, &captured, &capturedNext, capturedHead);
+	report.played = played.count;
+	report.captured = captured.count;
+	if (delay) clearHistogram(delay);
+
+	uint latestMatch = noInput;
+	for (uint i=0; i<played.count; ++i) {
+		RecordedInput* input = &played[i];
+		uint slot = inputSlot(input->key);
+		uint match = capturedHead[slot];
+		while (match != noInput && captured[match].frame < input->frame) {
+			match = capturedNext[match];
+		}
+		uint nextPlayed = playedNext[i];
+		if (match == noInput || (nextPlayed != noInput && captured[match].frame > played[nextPlayed].frame)) {
+			capturedHead[slot] = match;
+			report.dropped += 1;
+			continue;
+		}
+		capturedHead[slot] = capturedNext[match];
+
+		uint32 lag = captured[match].frame - input->frame;
+		if (lag == 0) report.onTime += 1;
+		else report.late += 1;
+		if (lag > report.worstFrameLag) report.worstFrameLag = lag;
+		if (latestMatch != noInput && match < latestMatch) report.reordered += 1;
+		if (latestMatch == noInput || match > latestMatch) latestMatch = match;
+		if (delay) recordDuration(delay, (int64)(captured[match].time - input->time));
+	}
+	report.extra = report.captured - (report.onTime + report.late);
+
+	played.freeMemory();
+	playedNext.freeMemory();
+	captured.freeMemory();
+	capturedNext.freeMemory();
+	return report;
+}
+
+// Plays the recording once from the start frame, recording what comes back
+void startVerification(AppData* data, uint64 startTime)
+{
+	if (data->mode == Mode_playback) {
+		releasePressedKeys(data);
+	}
+	data->verifying = true;
+	data->verificationEndTime = UINT64_MAX;
+	startPlayback(data, startTime);
+}
+
+// How long the last keys played get to come back after playback ends
+const uint64 verificationGracePeriod = 100000000;
+
+// True once playback has ended and the grace period after it has passed, so finishVerification is due.
+// Called by the recorder on every wakeup while verifying.
+bool verificationDue(AppData* data, uint64 now)
+{
+	if (!data->verifying || data->mode == Mode_playback) return false;
+	if (data->verificationEndTime == UINT64_MAX) data->verificationEndTime = now;
+	return now - data->verificationEndTime >= verificationGracePeriod;
+}
+
+// Stops playback if it hasn't finished, and compares what came back with the recording.
+// Give the last keys played time to come back before calling it, see verificationDue.
+FidelityReport finishVerification(AppData* data, Histogram* delay)
+{
+	if (data->mode == Mode_playback) {
+		releasePressedKeys(data);
+		stopPlayback(data);
+	}
+	data->verifying = false;
+	FidelityReport report = compareLoopback(&data->recording, data->playbackStartFrame, &data->loopback, delay);
+	freeRecording(&data->loopback);
+	return report;
+}
+
+void formatFidelityReport(char* text, uint size, FidelityReport* report, Histogram* delay)
+{
+	HistogramSummary s = summarizeHistogram(delay);
+	snprintf(text, size,
+		"Fidelity: %.2f%% of %u inputs came back on their frame\n"
+		"Late: %u (worst by %u frames), dropped: %u, extra: %u, reordered: %u\n"
+		"Delay: p50 %.1fus, p99 %.1fus, p99.9 %.1fus, max %.1fus\n",
+		fidelity(report), report->played,
+		report->late, report->worstFrameLag, report->dropped, report->extra, report->reordered,
+		s.p50 / 1000.0, s.p99 / 1000.0, s.p999 / 1000.0, s.max / 1000.0);
+}
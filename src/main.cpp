@@ -1,69 +1,70 @@
 #include "Platform.h"
 #include "GUI.h"
+#include "RecorderThread.h"
+#include "RecordingFile.h"
+#include "KeyNames.h"
 
-enum Mode {
-	Mode_idle,
-	Mode_recording,
-	Mode_playback,
-	Mode_waitingForRecordKey,
-	Mode_waitingForPlaybackKey,
-	Mode_waitingForStopKey
-};
-
-enum PlaybackSpeed {
-	PlaybackSpeed_normal,
-	PlaybackSpeed_trimStartup,
-	PlaybackSpeed_fast
-};
-
-struct RecordedInput
-{
-	KeyInput key;
-	uint32 frame;
-};
-
-// Persistent data that needs to get passed around
-struct AppData
+void saveRecording(RecorderThread* recorder)
 {
-	DynamicArray<RecordedInput> recording;
-	Mode mode;
-	PlaybackSpeed playbackSpeed;
-	KeyInput startRecordingKey;
-	KeyInput playbackRecordingKey;
-	KeyInput stopPlaybackKey;
-	uint32 recordingFrameNumber;
-	uint nextPlaybackInputIndex;
-	int enabled;
-	int loop;
-};
-
-void saveRecording(AppData* data)
-{
-	if (FILE* file = openFileFromSaveDialog()) {
-		for (uint i=0; i<data->recording.count; ++i) {
-			RecordedInput input = data->recording[i];
-			fprintf(file, "%d %d %d %d %s\n", input.key.scancode, input.key.extended, input.key.type, input.frame, keyToString(input.key).c_str());
+	char path[MAX_PATH];
+	if (pathFromSaveDialog(path)) {
+		// The copy is in memory, so saving over the file the recording was loaded from is safe
+		Recording recording = copyRecording(recorder);
+		if (!saveRecordingFile(&recording, path)) {
+			char message[MAX_PATH + 64];
+			snprintf(message, sizeof(message), "%s\n\nCouldn't be saved.", path);
+			MessageBoxA(0, message, "Keyboard Recorder", MB_OK | MB_ICONWARNING);
 		}
-		fclose(file);
+		freeRecording(&recording);
 	}
 }
 
-void loadRecording(AppData* data)
+void loadRecording(RecorderThread* recorder)
 {
-	if (FILE* file = openFileFromLoadDialog()) {
-		data->recording.clear();
-		char line[256];
-		while (fgets(line, sizeof(line), file)) {
-			RecordedInput input = {0};
-			sscanf(line, "%hd %d %d %d", &input.key.scancode, &input.key.extended, &input.key.type, &input.frame);
-			data->recording.push_back(input);
+	char path[MAX_PATH];
+	if (pathFromLoadDialog(path)) {
+		// Text recordings take the current frame rate. The recorder's own clock belongs to its thread.
+		RecorderStatus status = getRecorderStatus(recorder);
+		FrameClock clock;
+		initFrameClock(&clock, status.rateNumerator, status.rateDenominator, 0);
+		Recording recording = {0};
+		LoadError error;
+		if (loadRecordingFile(&recording, path, &clock, &error)) {
+			replaceRecording(recorder, recording);
+		}
+		else {
+			freeRecording(&recording);
+			char message[MAX_PATH + 128];
+			if (error.line) snprintf(message, sizeof(message), "%s\n\nLine %u: %s.", path, error.line, error.reason);
+			else snprintf(message, sizeof(message), "%s\n\n%s.", path, error.reason);
+			MessageBoxA(0, message, "Keyboard Recorder", MB_OK | MB_ICONWARNING);
 		}
-		fclose(file);
 	}
 }
 
-void updateGUI(GUI* gui, AppData* data, WindowInput input, int windowWidth, int windowHeight, bool windowActive)
+struct FrameRatePreset
 {
+	const char* name;
+	uint64 rateNumerator;
+	uint64 rateDenominator;
+};
+
+// Arcade boards and consoles rarely run at exactly 60 Hz
+static const FrameRatePreset frameRatePresets[] = {
+	{"60 Hz", 60, 1},
+	{"59.94 Hz (NTSC)", 60000, 1001},
+	{"60.0988 Hz (NES)", 39375000, 655171},
+	{"59.637 Hz (CPS1/CPS2)", 59637405, 1000000},
+	{"59.185 Hz (Neo Geo)", 59185606, 1000000},
+	{"57.5 Hz", 115, 2},
+	{"50 Hz (PAL)", 50, 1},
+};
+static const int frameRatePresetCount = sizeof(frameRatePresets)/sizeof(frameRatePresets[0]);
+
+// Returns true if it shows stats that change on their own, so it needs redrawing while nothing happens
+bool updateGUI(GUI* gui, RecorderThread* recorder, KeyNames* keyNames, RecorderStatus* status, WindowInput input, int windowWidth, int windowHeight, bool windowActive)
+{
+	bool liveStats = false;
 	nk_context *ctx = &gui->ctx;
 
 	// Copy input over to GUI
@@ -82,274 +83,283 @@ void updateGUI(GUI* gui, AppData* data, WindowInput input, int windowWidth, int
 		nk_layout_row_begin(ctx, NK_STATIC, 25, 5);
 		nk_layout_row_push(ctx, 45);
 		if (nk_button_label(ctx, "Save")) {
-			saveRecording(data);
+			saveRecording(recorder);
 		}
 		if (nk_button_label(ctx, "Load")) {
-			loadRecording(data);
+			loadRecording(recorder);
+		}
+		// Plays the recording once and checks the keys that come back through raw input
+		nk_layout_row_push(ctx, 50);
+		if (nk_button_label(ctx, "Verify") && status->recordingCount > 0) {
+			startVerification(recorder);
 		}
 
 		// Key setting buttons
+		static KeyLabel recordLabel, playbackLabel, stopLabel, replayLabel;
 		nk_layout_row_dynamic(ctx, 30, 1);
-		std::string label = "Record key: " + keyToString(data->startRecordingKey);
+		const char* label = keyLabel(&recordLabel, "Record key", keyNames, status->startRecordingKey);
 		bool highlight = false;
-		if (data->mode == Mode_waitingForRecordKey)
+		if (status->mode == Mode_waitingForRecordKey)
 		{
 			highlight = true;
 			label = "Press any key";
 		}
-		if (doButton(ctx, label, highlight)) data->mode = Mode_waitingForRecordKey;
+		if (doButton(ctx, label, highlight)) status->mode = Mode_waitingForRecordKey;
 
-		label = "Playback key: " + keyToString(data->playbackRecordingKey);
+		label = keyLabel(&playbackLabel, "Playback key", keyNames, status->playbackRecordingKey);
 		highlight = false;
-		if (data->mode == Mode_waitingForPlaybackKey)
+		if (status->mode == Mode_waitingForPlaybackKey)
 		{
 			highlight = true;
 			label = "Press any key";
 		}
-		if (doButton(ctx, label, highlight)) data->mode = Mode_waitingForPlaybackKey;
+		if (doButton(ctx, label, highlight)) status->mode = Mode_waitingForPlaybackKey;
 
-		label = "Stop key: " + keyToString(data->stopPlaybackKey);
+		label = keyLabel(&stopLabel, "Stop key", keyNames, status->stopPlaybackKey);
 		highlight = false;
-		if (data->mode == Mode_waitingForStopKey)
+		if (status->mode == Mode_waitingForStopKey)
 		{
 			highlight = true;
 			label = "Press any key";
 		}
-		if (doButton(ctx, label, highlight)) data->mode = Mode_waitingForStopKey;
+		if (doButton(ctx, label, highlight)) status->mode = Mode_waitingForStopKey;
+
+		label = keyLabel(&replayLabel, "Save replay key", keyNames, status->saveReplayKey);
+		highlight = false;
+		if (status->mode == Mode_waitingForReplayKey)
+		{
+			highlight = true;
+			label = "Press any key";
+		}
+		if (doButton(ctx, label, highlight)) status->mode = Mode_waitingForReplayKey;
 
 		// Playback speed radio buttons
 		nk_layout_row_dynamic(ctx, 20, 1);
 		nk_label(ctx, "Playback speed:", NK_TEXT_LEFT);
 		nk_layout_row_begin(ctx, NK_STATIC, 20, 3);
 		nk_layout_row_push(ctx, 50);
-		if (nk_option_label(ctx, "1:1", data->playbackSpeed == PlaybackSpeed_normal)) data->playbackSpeed = PlaybackSpeed_normal;
+		if (nk_option_label(ctx, "1:1", status->playbackSpeed == PlaybackSpeed_normal)) status->playbackSpeed = PlaybackSpeed_normal;
 		nk_layout_row_push(ctx, 110);
-		if (nk_option_label(ctx, "Trim Startup", data->playbackSpeed == PlaybackSpeed_trimStartup)) data->playbackSpeed = PlaybackSpeed_trimStartup;
+		if (nk_option_label(ctx, "Trim Startup", status->playbackSpeed == PlaybackSpeed_trimStartup)) status->playbackSpeed = PlaybackSpeed_trimStartup;
 		nk_layout_row_push(ctx, 50);
-		if (nk_option_label(ctx, "Fast", data->playbackSpeed == PlaybackSpeed_fast)) data->playbackSpeed = PlaybackSpeed_fast;
+		if (nk_option_label(ctx, "Fast", status->playbackSpeed == PlaybackSpeed_fast)) status->playbackSpeed = PlaybackSpeed_fast;
+		nk_layout_row_end(ctx);
+
+		// Playback timing radio buttons
+		nk_layout_row_begin(ctx, NK_STATIC, 20, 3);
+		nk_layout_row_push(ctx, 60);
+		nk_label(ctx, "Timing:", NK_TEXT_LEFT);
+		nk_layout_row_push(ctx, 70);
+		if (nk_option_label(ctx, "Frame", status->playbackTiming == PlaybackTiming_frame)) status->playbackTiming = PlaybackTiming_frame;
+		nk_layout_row_push(ctx, 70);
+		if (nk_option_label(ctx, "Exact", status->playbackTiming == PlaybackTiming_exact)) status->playbackTiming = PlaybackTiming_exact;
 		nk_layout_row_end(ctx);
 
 		// Checkbox for loop
-		nk_layout_row_dynamic(ctx, 30, 2);
-		nk_checkbox_label(ctx, "Loop", &data->loop);
+		nk_layout_row_dynamic(ctx, 30, 3);
+		nk_checkbox_label(ctx, "Loop", &status->loop);
 		// Checkbox for enable toggle
-		nk_checkbox_label(ctx, "Enabled", &data->enabled);
-	}
-	nk_end(ctx);
-}
-
-void recordInputs(AppData* data, WindowInput input)
-{
-	for (uint i=0; i<input.keyEvents.count; ++i)
-	{
-		KeyInput key = input.keyEvents[i];
-		// Skip keys used for recording and playback
-		if (!(key.scancode == data->startRecordingKey.scancode && key.extended == data->startRecordingKey.extended)
-				&& !(key.scancode == data->playbackRecordingKey.scancode && key.extended == data->playbackRecordingKey.extended))
-		{
-			RecordedInput action = {0};
-			action.key = key;
-			action.frame = data->recordingFrameNumber;
-			data->recording.push_back(action);
-		}
-	}
-}
-
-void playbackInputs(AppData* data)
-{
-	while (data->nextPlaybackInputIndex < data->recording.size())
-	{
-		uint inputIndex = data->nextPlaybackInputIndex;
-
-		// If trimming startup, skip ahead to first input
-		if (inputIndex == 0 && data->playbackSpeed == PlaybackSpeed_trimStartup)
-		{
-			data->recordingFrameNumber = data->recording[0].frame;
-		}
-
-		if (data->playbackSpeed == PlaybackSpeed_fast)
-		{
-			simulateInput(data->recording[inputIndex].key);
-			data->nextPlaybackInputIndex += 1;
-			return;
-		}
-
-		// Normal playback speed
-		if (data->recording[inputIndex].frame > data->recordingFrameNumber)
-		{
-			return;
+		nk_checkbox_label(ctx, "Enabled", &status->enabled);
+		// Checkbox for instant replay, which keeps the last few minutes of input ready to save
+		nk_checkbox_label(ctx, "Replay", &status->instantReplay);
+
+		// Frame rate presets. The monitor's rate is the default and shows up as a custom rate.
+		char rateLabel[32];
+		snprintf(rateLabel, sizeof(rateLabel), "%.4g Hz", (double)status->rateNumerator / (double)status->rateDenominator);
+		nk_layout_row_begin(ctx, NK_STATIC, 20, 2);
+		nk_layout_row_push(ctx, 80);
+		nk_label(ctx, "Frame rate:", NK_TEXT_LEFT);
+		nk_layout_row_push(ctx, 170);
+		if (nk_combo_begin_label(ctx, rateLabel, nk_vec2(170, 200))) {
+			nk_layout_row_dynamic(ctx, 20, 1);
+			for (int i=0; i<frameRatePresetCount; ++i) {
+				if (nk_combo_item_label(ctx, frameRatePresets[i].name, NK_TEXT_LEFT)) {
+					status->rateNumerator = frameRatePresets[i].rateNumerator;
+					status->rateDenominator = frameRatePresets[i].rateDenominator;
+				}
+			}
+			nk_combo_end(ctx);
 		}
-		simulateInput(data->recording[inputIndex].key);
-		data->nextPlaybackInputIndex += 1;
-	}
-	// Reached the end
-	if (data->loop) {
-		data->nextPlaybackInputIndex = 0;
-		data->recordingFrameNumber = 0;
-	}
-	else {
-		data->mode = Mode_idle;
-	}
-}
+		nk_layout_row_end(ctx);
 
-void releasePressedKeys(AppData* data)
-{
-	// If playback is cancelled, keys can get stuck down.
-	// Send key-up messages for any keys that could be down when playback ended.
-	for (unsigned int i=0; i<data->nextPlaybackInputIndex; ++i) {
-		if (data->recording[i].key.type == KeyInput::press) {
-			KeyInput release = data->recording[i].key;
-			release.type = KeyInput::release;
-			simulateInput(release);
-		}
-	}
-}
+		// Playback start frame. Seeking goes through the recording's frame index, so scrubbing is cheap.
+		int startFrame = (int)status->playbackStartFrame;
+		int lastFrame = status->recordingFrameCount ? (int)status->recordingFrameCount - 1 : 0;
+		nk_layout_row_begin(ctx, NK_STATIC, 20, 2);
+		nk_layout_row_push(ctx, 80);
+		nk_label(ctx, "Start frame:", NK_TEXT_LEFT);
+		nk_layout_row_push(ctx, 170);
+		nk_property_int(ctx, "#", 0, &startFrame, lastFrame, 1, 1);
+		nk_layout_row_end(ctx);
+		status->playbackStartFrame = (uint32)startFrame;
 
-bool keyWasPressed(DynamicArray<KeyInput> keys, KeyInput target)
-{
-	for (uint i = 0; i < keys.count; ++i) {
-		if (keys[i].type == KeyInput::press && keys[i].scancode == target.scancode && keys[i].extended == target.extended) {
-			return true;
+		// Frame deadline error
+		nk_layout_row_dynamic(ctx, 20, 1);
+		nk_labelf(ctx, NK_TEXT_LEFT, "Frame error: %.2fms avg, %.2fms worst", status->averageFrameError / 1000000.0, status->worstFrameError / 1000000.0);
+
+		// Timing histograms. The recorder thread keeps adding to them, so they're read as they are.
+		TimingStats* timing = recorder->data.timing;
+		if (timing && nk_tree_push(ctx, NK_TREE_TAB, "Timing", NK_MINIMIZED)) {
+			liveStats = true;
+			const char* names[] = {"Injection delay", "Capture latency", "Frame period error"};
+			Histogram* histograms[] = {&timing->injectionDelay, &timing->captureLatency, &timing->framePeriodError};
+			nk_layout_row_dynamic(ctx, 18, 1);
+			for (int i=0; i<3; ++i) {
+				HistogramSummary s = summarizeHistogram(histograms[i]);
+				nk_labelf(ctx, NK_TEXT_LEFT, "%s, %llu samples", names[i], (unsigned long long)s.count);
+				nk_labelf(ctx, NK_TEXT_LEFT, "  p50 %.0f  p99 %.0f  p99.9 %.0f  max %.0fus", s.p50 / 1000.0, s.p99 / 1000.0, s.p999 / 1000.0, s.max / 1000.0);
+			}
+			nk_tree_pop(ctx);
 		}
 	}
-	return false;
-}
-
-void startRecording(AppData* data, Window* win)
-{
-	data->mode = Mode_recording;
-	data->recordingFrameNumber = 0;
-	data->recording.clear();
-	setWindowTitle(win, "O Keyboard Recorder");
+	nk_end(ctx);
+	return liveStats;
 }
 
-void startPlayback(AppData* data, Window* win)
-{
-	data->mode = Mode_playback;
-	data->recordingFrameNumber = 0;
-	data->nextPlaybackInputIndex = 0;
-	setWindowTitle(win, "> Keyboard Recorder");
-}
+// How often the stats are redrawn while they change
+const uint guiRefreshInterval = 100;
 
-void stopPlayback(AppData* data, Window* win)
+const char* windowTitle(Mode mode)
 {
-	data->mode = Mode_idle;
-	data->recordingFrameNumber = 0;
-	data->nextPlaybackInputIndex = 0;
-	setWindowTitle(win, "- Keyboard Recorder");
+	if (mode == Mode_recording) return "O Keyboard Recorder";
+	if (mode == Mode_playback) return "> Keyboard Recorder";
+	return "- Keyboard Recorder";
 }
 
 int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PSTR szCmdLine, int iCmdShow)
 {
+	PROFILE_THREAD("GUI");
 	Window win = {0};
-	createWindow(&win, 280, 230);
+	createWindow(&win, 280, 365);
 	setWindowTitle(&win, "- Keyboard Recorder");
 	WindowInput input = {0};
-	AppData data = {0};
+	static Win32Backend win32Backend;
+	RecorderThread recorder = {};
+	initWin32Backend(&recorder.data.backend, &win32Backend);
+	char fontCachePath[MAX_PATH];
+	pathNextToExecutable(fontCachePath, "KeyboardRecorder.fontcache");
 	GUI gui = {0};
-	initGUI(&gui);
+	initGUI(&gui, fontCachePath);
+	static KeyNames keyNames;
+	refreshKeyNames(&keyNames, &recorder.data.backend);
 	bool run = true;
 
-	data.startRecordingKey.scancode = MapVirtualKey(VK_F1, MAPVK_VK_TO_VSC);
-	data.playbackRecordingKey.scancode = MapVirtualKey(VK_F2, MAPVK_VK_TO_VSC);
-	data.stopPlaybackKey.scancode = MapVirtualKey(VK_F3, MAPVK_VK_TO_VSC);
-	data.enabled = true;
+	recorder.data.startRecordingKey.scancode = MapVirtualKey(VK_F1, MAPVK_VK_TO_VSC);
+	recorder.data.playbackRecordingKey.scancode = MapVirtualKey(VK_F2, MAPVK_VK_TO_VSC);
+	recorder.data.stopPlaybackKey.scancode = MapVirtualKey(VK_F3, MAPVK_VK_TO_VSC);
+	recorder.data.saveReplayKey.scancode = MapVirtualKey(VK_F4, MAPVK_VK_TO_VSC);
+	recorder.data.enabled = true;
+	// Instant replay is on by default. The buffer is allocated once here and never grows.
+	static ReplayBuffer replayBuffer;
+	recorder.data.replay = &replayBuffer;
+	static TimingStats timing;
+	recorder.data.timing = &timing;
+	recorder.data.instantReplay = true;
+	recorder.data.replayWindow = 5*60*1000000000ull;
+	recorder.onModeChange = wakeWindow;
+	recorder.onModeChangeUser = &win;
+	initFrameClock(&recorder.data.clock, getRefreshRate(&win), 1, 1000000);
+
+	// The last recording is kept in a journal next to the executable, so it survives a crash or an unsaved exit
+	char journalPath[MAX_PATH];
+	pathNextToExecutable(journalPath, "KeyboardRecorder.journal");
+	bool journalFinished = false;
+	bool recovered = recoverJournal(&recorder.data.recording, journalPath, &journalFinished);
+	static Journal journal;
+	startJournal(&journal, journalPath);
+	recorder.journal = &journal;
+	startRecorderThread(&recorder);
+	if (recovered && !journalFinished) {
+		char message[128];
+		snprintf(message, sizeof(message), "Recovered an interrupted recording of %u inputs.", getRecorderStatus(&recorder).recordingCount);
+		MessageBoxA(win.hwnd, message, "Keyboard Recorder", MB_OK | MB_ICONINFORMATION);
+	}
+	Mode previousMode = Mode_idle;
+	uint32 previousVerificationCount = 0;
+	bool timerRunning = false;
 
-	// Frame-based loop like in a game
+	// Recording and playback happen on the recorder thread, so this loop only has to wake up for window
+	// messages and mode changes, plus a timer tick while the frame error and timing stats are changing.
 	while (run)
 	{
-		// Save power if we don't need to update every frame
-		bool waitForMessages = data.mode == Mode_idle;
-
 		// Handle window messages
-		updateWindowInput(&win, &input, waitForMessages);
+		{
+			PROFILE_ZONE("Window messages");
+			updateWindowInput(&win, &input, true);
+		}
 		if (input.quit) run = false;
+		if (input.keyboardLayoutChanged) refreshKeyNames(&keyNames, &recorder.data.backend);
 
 		bool windowActive = win.hwnd == GetActiveWindow();
 		int windowWidth = getWindowWidth(win);
 		int windowHeight = getWindowHeight(win);
 
-		// Update based on which mode the app is in
-		if (data.mode == Mode_idle && data.enabled) {
-			setWindowTitle(&win, "- Keyboard Recorder");
-			if (keyWasPressed(input.keyEvents, data.startRecordingKey)) {
-				startRecording(&data, &win);
-			}
-			if (keyWasPressed(input.keyEvents, data.playbackRecordingKey)) {
-				startPlayback(&data, &win);
-			}
-
-		}
-		else if (data.mode == Mode_waitingForRecordKey && windowActive) {
-			if (input.mouse.leftButton.pressed) {
-				data.mode = Mode_idle;
-			}
-			if (input.keyEvents.count > 0) {
-				data.startRecordingKey = input.keyEvents[0];
-				data.mode = Mode_idle;
-			}
-		}
-		else if (data.mode == Mode_waitingForPlaybackKey && windowActive) {
-			if (input.mouse.leftButton.pressed) {
-				data.mode = Mode_idle;
-			}
-			if (input.keyEvents.count > 0) {
-				data.playbackRecordingKey = input.keyEvents[0];
-				data.mode = Mode_idle;
-			}
+		RecorderStatus status = getRecorderStatus(&recorder);
+		if (status.windowActive != (int)windowActive) {
+			RecorderStatus activeStatus = status;
+			activeStatus.windowActive = windowActive;
+			applyStatusChanges(&recorder, status, activeStatus);
+			status = activeStatus;
 		}
-		else if (data.mode == Mode_waitingForStopKey && windowActive) {
-			if (input.mouse.leftButton.pressed) {
-				data.mode = Mode_idle;
-			}
-			if (input.keyEvents.count > 0) {
-				data.stopPlaybackKey = input.keyEvents[0];
-				data.mode = Mode_idle;
-			}
+		if (status.mode != previousMode) {
+			setWindowTitle(&win, windowTitle(status.mode));
+			previousMode = status.mode;
 		}
-		else if (data.mode == Mode_recording) {
-			if (keyWasPressed(input.keyEvents, data.startRecordingKey)) {
-				data.mode = Mode_idle;
-			}
-			else if (keyWasPressed(input.keyEvents, data.playbackRecordingKey)) {
-				startPlayback(&data, &win);
-			}
-			else {
-				recordInputs(&data, input);
-			}
+		if (status.verificationCount != previousVerificationCount) {
+			previousVerificationCount = status.verificationCount;
+			char text[512];
+			formatFidelityReport(text, sizeof(text), &status.verification, &recorder.verificationDelay);
+			MessageBoxA(win.hwnd, text, "Keyboard Recorder", MB_OK | MB_ICONINFORMATION);
 		}
-		else if (data.mode == Mode_playback) {
-			if (!data.enabled) {
-				data.mode = Mode_idle;
-				setWindowTitle(&win, "- Keyboard Recorder");
+
+		// GUI
+		if (windowActive) {
+			RecorderStatus editedStatus = status;
+			// Clicking anywhere cancels waiting for a key binding
+			bool waitingForKey = status.mode == Mode_waitingForRecordKey || status.mode == Mode_waitingForPlaybackKey || status.mode == Mode_waitingForStopKey || status.mode == Mode_waitingForReplayKey;
+			if (waitingForKey && input.mouse.leftButton.pressed) {
+				editedStatus.mode = Mode_idle;
 			}
-			else if (keyWasPressed(input.keyEvents, data.startRecordingKey)) {
-				releasePressedKeys(&data);
-				startRecording(&data, &win);
+			bool liveStats;
+			{
+				PROFILE_ZONE("Update GUI");
+				liveStats = updateGUI(&gui, &recorder, &keyNames, &editedStatus, input, windowWidth, windowHeight, windowActive);
 			}
-			else if (keyWasPressed(input.keyEvents, data.playbackRecordingKey)) {
-				releasePressedKeys(&data);
-				startPlayback(&data, &win);
+			liveStats = liveStats || status.mode == Mode_playback || status.mode == Mode_recording;
+			if (liveStats != timerRunning) {
+				setWindowTimer(&win, liveStats ? guiRefreshInterval : 0);
+				timerRunning = liveStats;
 			}
-			else if (keyWasPressed(input.keyEvents, data.stopPlaybackKey)) {
-				releasePressedKeys(&data);
-				stopPlayback(&data, &win);
+			applyStatusChanges(&recorder, status, editedStatus);
+			bool redrawn;
+			{
+				PROFILE_ZONE("Render GUI");
+				redrawn = renderGUI(&gui, windowWidth, windowHeight);
 			}
-			else {
-				playbackInputs(&data);
+			if (redrawn) {
+				PROFILE_ZONE("Swap buffers");
+				swapBuffers(&win);
 			}
 		}
-
-		// GUI
-		if (windowActive) {
-			updateGUI(&gui, &data, input, windowWidth, windowHeight, windowActive);
-			renderGUI(&gui, windowWidth, windowHeight);
+		else if (timerRunning) {
+			// Nothing is drawn while the window is in the background
+			setWindowTimer(&win, 0);
+			timerRunning = false;
 		}
-
-		// Finish frame
-		++data.recordingFrameNumber;
-		swapBuffers(&win);
 	}
 
+	stopRecorderThread(&recorder);
+	stopJournal(&journal);
+	char timingPath[MAX_PATH];
+	pathNextToExecutable(timingPath, "KeyboardRecorder.timing.txt");
+	if (FILE* file = fopen(timingPath, "w")) {
+		writeTimingStats(&timing, file);
+		fclose(file);
+	}
+#ifdef PROFILE
+	char tracePath[MAX_PATH];
+	pathNextToExecutable(tracePath, "KeyboardRecorder.trace.json");
+	PROFILE_WRITE_TRACE(tracePath);
+#endif
 	return 0;
 }
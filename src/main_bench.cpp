@@ -0,0 +1,248 @@
+// Headless benchmarks for the recorder engine, run through the simulation harness so results don't
+// depend on a keyboard, a window or the scheduler.
+// Usage: keyboard-recorder-bench [--max events] [--file path]
+// Runs at 10^3 events and up by powers of ten to --max (10^7 by default), and prints one JSON object
+// per line, so runs can be saved and compared before and after a change:
+//   record     events recorded per second, and nanoseconds per recorder frame while recording
+//   playback   events played back per second, and nanoseconds per recorder frame while playing
+//   save       writing the recording to a file, in MB/s
+//   load       loading it back and reading every input, in MB/s
+//   text_load  importing it as a legacy text recording, in MB/s, up to 10^6 events
+//   text_load_sscanf  the same with the sscanf parser text recordings used to be read with, for comparison
+//   fidelity   whether playback injected exactly the recorded keys on the recorded frames, up to 10^5 events
+//   loopback   the loopback verifier's report, with the memory backend capturing what it injects, up to 10^5 events
+// The recording is written to --file, keyboard-recorder-bench.rec by default, which is deleted afterwards.
+#include <chrono>
+#include "RecordingFile.h"
+#include "Simulation.h"
+#include "Verify.h"
+
+// Keys are mashed 8 events a frame, pressing and releasing 16 keys in turn. Every key arrives in the
+// middle of a frame, so which frame it belongs to never depends on rounding.
+const uint benchEventsPerFrame = 8;
+
+double secondsSince(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+uint64 middleOfFrame(Simulation* sim)
+{
+	return getTime(&sim->data.backend) + sim->data.clock.framePeriod / 2;
+}
+
+// Taps a hotkey and runs until the recorder has seen it
+void tapKey(Simulation* sim, unsigned short scancode)
+{
+	scriptKey(sim, middleOfFrame(sim), scancode, KeyInput::press);
+	scriptKey(sim, middleOfFrame(sim) + 1000, scancode, KeyInput::release);
+	runSimulationFrames(sim, 2);
+}
+
+// Records events inputs into sim's recording. Returns the time it took.
+double benchRecord(Simulation* sim, uint64 events)
+{
+	tapKey(sim, sim->data.startRecordingKey.scancode);
+	uint32 startFrame = sim->frame;
+	// Recording sleeps until keys arrive, so each batch goes in the middle of the next recorded frame
+	uint32 recordedFrame = frameAtTime(&sim->data.clock, getTime(&sim->data.backend) - sim->data.recordingStartTime) + 1;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (uint64 queued = 0; queued < events; ++recordedFrame) {
+		uint64 time = sim->data.recordingStartTime + simulationFrameTime(sim, recordedFrame) + sim->data.clock.framePeriod / 2;
+		for (uint i = 0; i < benchEventsPerFrame && queued < events; ++i, ++queued) {
+			unsigned short scancode = (unsigned short)(0x10 + (queued / 2) % 16);
+			scriptKey(sim, time + i*1000, scancode, queued % 2 ? KeyInput::release : KeyInput::press);
+		}
+		runSimulationScript(sim);
+	}
+	runSimulationFrames(sim, 1);
+	double seconds = secondsSince(start);
+	tapKey(sim, sim->data.startRecordingKey.scancode);
+	printf("{\"benchmark\":\"record\",\"events\":%llu,\"seconds\":%.6f,\"events_per_second\":%.0f,\"ns_per_frame\":%.1f}\n",
+		(unsigned long long)events, seconds, events / seconds, seconds * 1e9 / (sim->frame - startFrame));
+	return seconds;
+}
+
+void benchPlayback(Simulation* sim, uint64 events)
+{
+	tapKey(sim, sim->data.playbackRecordingKey.scancode);
+	uint32 startFrame = sim->frame;
+	uint64 startInjections = sim->injectionCount;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	runSimulationWhile(sim, Mode_playback, UINT32_MAX);
+	double seconds = secondsSince(start);
+	uint64 played = sim->injectionCount - startInjections;
+	printf("{\"benchmark\":\"playback\",\"events\":%llu,\"played\":%llu,\"seconds\":%.6f,\"events_per_second\":%.0f,\"ns_per_frame\":%.1f}\n",
+		(unsigned long long)events, (unsigned long long)played, seconds, played / seconds, seconds * 1e9 / (sim->frame - startFrame));
+}
+
+void benchSaveAndLoad(Simulation* sim, uint64 events, const char* path)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	FILE* file = fopen(path, "wb");
+	bool saved = file && writeRecording(&sim->data.recording, file);
+	if (file) fclose(file);
+	double saveSeconds = secondsSince(start);
+
+	MappedFile mapped;
+	double megabytes = mapFile(&mapped, path) ? mapped.size / 1e6 : 0;
+	unmapFile(&mapped);
+	printf("{\"benchmark\":\"save\",\"events\":%llu,\"ok\":%s,\"megabytes\":%.3f,\"seconds\":%.6f,\"megabytes_per_second\":%.1f}\n",
+		(unsigned long long)events, saved ? "true" : "false", megabytes, saveSeconds, megabytes / saveSeconds);
+
+	// Loading a current recording only maps it, so the time is in reading the inputs
+	start = std::chrono::steady_clock::now();
+	Recording recording = {0};
+	LoadError error;
+	bool loaded = loadRecordingFile(&recording, path, &sim->data.clock, &error);
+	RecordingCursor cursor = {0};
+	RecordedInput input;
+	uint64 read = 0;
+	while (loaded && readInput(&recording, &cursor, &input)) ++read;
+	double loadSeconds = secondsSince(start);
+	freeRecording(&recording);
+	printf("{\"benchmark\":\"load\",\"events\":%llu,\"ok\":%s,\"megabytes\":%.3f,\"seconds\":%.6f,\"megabytes_per_second\":%.1f}\n",
+		(unsigned long long)events, loaded && read == events ? "true" : "false", megabytes, loadSeconds, megabytes / loadSeconds);
+}
+
+// The text parser as it was before readTextRecording, kept only as a baseline. It copies the file to
+// terminate it, and has sscanf find every field of every line.
+bool readTextRecordingWithSscanf(Recording* recording, const char* path, FrameClock* clock)
+{
+	MappedFile mapped;
+	if (!mapFile(&mapped, path)) return false;
+	char* text = (char*)malloc(mapped.size + 1);
+	if (mapped.size) memcpy(text, mapped.bytes, mapped.size);
+	text[mapped.size] = 0;
+	unmapFile(&mapped);
+
+	clearRecording(recording, clock);
+	char* line = text;
+	while (*line) {
+		char* lineEnd = strchr(line, '\n');
+		if (lineEnd) *lineEnd = 0;
+		RecordedInput input = {0};
+		unsigned short scancode;
+		unsigned int extended, type;
+		unsigned long long time = 0;
+		int fieldCount = sscanf(line, "%hu %u %u %u @%llu", &scancode, &extended, &type, &input.frame, &time);
+		if (fieldCount >= 4) {
+			input.key.scancode = scancode;
+			input.key.extended = extended;
+			input.key.type = type ? KeyInput::release : KeyInput::press;
+			input.time = fieldCount == 5 ? time : timeAtFrame(clock, input.frame);
+			appendInput(recording, input);
+		}
+		if (!lineEnd) break;
+		line = lineEnd + 1;
+	}
+	free(text);
+	return true;
+}
+
+void benchTextLoad(Simulation* sim, uint64 events, const char* path)
+{
+	FILE* file = fopen(path, "wb");
+	if (!file) return;
+	RecordingCursor cursor = {0};
+	RecordedInput input;
+	while (readInput(&sim->data.recording, &cursor, &input)) {
+		fprintf(file, "%d %d %d %u @%llu\n", input.key.scancode, input.key.extended, input.key.type, input.frame, (unsigned long long)input.time);
+	}
+	fclose(file);
+
+	MappedFile mapped;
+	double megabytes = mapFile(&mapped, path) ? mapped.size / 1e6 : 0;
+	unmapFile(&mapped);
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	Recording recording = {0};
+	LoadError error;
+	bool loaded = loadRecordingFile(&recording, path, &sim->data.clock, &error);
+	double seconds = secondsSince(start);
+	printf("{\"benchmark\":\"text_load\",\"events\":%llu,\"ok\":%s,\"megabytes\":%.3f,\"seconds\":%.6f,\"megabytes_per_second\":%.1f}\n",
+		(unsigned long long)events, loaded && recording.inputCount == events ? "true" : "false", megabytes, seconds, megabytes / seconds);
+	freeRecording(&recording);
+
+	start = std::chrono::steady_clock::now();
+	recording = {0};
+	loaded = readTextRecordingWithSscanf(&recording, path, &sim->data.clock);
+	seconds = secondsSince(start);
+	printf("{\"benchmark\":\"text_load_sscanf\",\"events\":%llu,\"ok\":%s,\"megabytes\":%.3f,\"seconds\":%.6f,\"megabytes_per_second\":%.1f}\n",
+		(unsigned long long)events, loaded && recording.inputCount == events ? "true" : "false", megabytes, seconds, megabytes / seconds);
+	freeRecording(&recording);
+}
+
+// Plays the recording back with every injection logged, and checks each went out on its recorded frame
+void checkFidelity(Simulation* sim, uint64 events)
+{
+	sim->injections.clear();
+	sim->logInjections = true;
+	tapKey(sim, sim->data.playbackRecordingKey.scancode);
+	// Frame timing plays an input recorded n frames after the record key on the nth frame
+	// boundary after the playback key, counting the one it was seen on as 0
+	uint32 startFrame = sim->frame - 1;
+	runSimulationWhile(sim, Mode_playback, UINT32_MAX);
+	sim->logInjections = false;
+
+	bool ok = sim->injections.count == events;
+	RecordingCursor cursor = {0};
+	RecordedInput input;
+	for (uint i = 0; ok && readInput(&sim->data.recording, &cursor, &input); ++i) {
+		Injection* injection = &sim->injections[i];
+		ok = sameKey(injection->key, input.key) && injection->key.type == input.key.type && injection->frame == startFrame + input.frame;
+	}
+	printf("{\"benchmark\":\"fidelity\",\"events\":%llu,\"ok\":%s}\n", (unsigned long long)events, ok ? "true" : "false");
+}
+
+// Verifies playback the way the front ends do, with injected keys looped back through capture
+void benchLoopback(Simulation* sim, uint64 events)
+{
+	sim->memory.loopback = true;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	startVerification(&sim->data, getTime(&sim->data.backend));
+	runSimulationWhile(sim, Mode_playback, UINT32_MAX);
+	runSimulationFrames(sim, 1);
+	static Histogram delay;
+	FidelityReport report = finishVerification(&sim->data, &delay);
+	double seconds = secondsSince(start);
+	sim->memory.loopback = false;
+	printf("{\"benchmark\":\"loopback\",\"events\":%llu,\"seconds\":%.6f,\"fidelity\":%.3f,\"late\":%u,\"dropped\":%u,\"extra\":%u,\"reordered\":%u}\n",
+		(unsigned long long)events, seconds, fidelity(&report), report.late, report.dropped, report.extra, report.reordered);
+}
+
+int main(int argc, char** argv)
+{
+	uint64 maxEvents = 10000000;
+	const char* path = "keyboard-recorder-bench.rec";
+	for (int i=1; i<argc; ++i) {
+		if (strcmp(argv[i], "--max") == 0 && i+1 < argc) {
+			maxEvents = strtoull(argv[++i], 0, 10);
+		}
+		else if (strcmp(argv[i], "--file") == 0 && i+1 < argc) {
+			path = argv[++i];
+		}
+		else {
+			fprintf(stderr, "Usage: keyboard-recorder-bench [--max events] [--file path]\n");
+			return 1;
+		}
+	}
+
+	for (uint64 events = 1000; events <= maxEvents; events *= 10) {
+		Simulation sim;
+		initSimulation(&sim, 60, 1);
+		sim.logInjections = false;
+		benchRecord(&sim, events);
+		benchPlayback(&sim, events);
+		benchSaveAndLoad(&sim, events, path);
+		if (events <= 1000000) benchTextLoad(&sim, events, path);
+		if (events <= 100000) checkFidelity(&sim, events);
+		if (events <= 100000) benchLoopback(&sim, events);
+		freeSimulation(&sim);
+		fflush(stdout);
+	}
+	remove(path);
+#ifdef PROFILE
+	PROFILE_WRITE_TRACE("keyboard-recorder-bench.trace.json");
+#endif
+	return 0;
+}
@@ -0,0 +1,215 @@
+// Headless Linux front end. Same hotkeys and recorder as the Windows build, without the GUI.
+// Usage: keyboard-recorder [--hz rate] [--start frame] [--replay minutes] [--verify] [recording.rec]
+// The rate can be fractional, e.g. 59.94 or 60000/1001, to match emulated hardware.
+// Playback starts at the given frame of the recording, and loops back to it.
+// The recording is loaded at startup if it exists and saved whenever a recording finishes.
+// Recordings are also journaled to recording.rec.journal as they are made, and one that was cut off
+// by a crash is recovered on the next start.
+// F4 saves the last few minutes of input (5 by default, 0 turns instant replay off) as the recording.
+// On exit it prints percentiles of injection delay, capture latency and frame period error.
+// --verify plays the recording once while reading the keys back from the uinput device, prints how
+// many came back on the right frame, and exits. Whatever window has focus gets the keys.
+#include <signal.h>
+#include <condition_variable>
+#include "LinuxBackend.h"
+#include "RecorderThread.h"
+#include "RecordingFile.h"
+
+static volatile sig_atomic_t quitRequested = 0;
+static std::mutex wakeLock;
+static std::condition_variable wakeCondition;
+
+void handleQuitSignal(int signal)
+{
+	(void)signal;
+	quitRequested = 1;
+}
+
+void wakeMainThread(void* user)
+{
+	(void)user;
+	wakeCondition.notify_one();
+}
+
+void saveRecording(RecorderThread* recorder, const char* path)
+{
+	// The copy is in memory, so saving over the file the recording was loaded from is safe
+	Recording recording = copyRecording(recorder);
+	if (!saveRecordingFile(&recording, path)) {
+		fprintf(stderr, "%s: Couldn't be saved\n", path);
+	}
+	freeRecording(&recording);
+}
+
+const char* modeName(Mode mode)
+{
+	if (mode == Mode_recording) return "recording";
+	if (mode == Mode_playback) return "playing back";
+	return "idle";
+}
+
+int main(int argc, char** argv)
+{
+	const char* recordingPath = 0;
+	uint64 rateNumerator = 60;
+	uint64 rateDenominator = 1;
+	uint32 startFrame = 0;
+	double replayMinutes = 5;
+	bool verify = false;
+	for (int i=1; i<argc; ++i) {
+		if (strcmp(argv[i], "--hz") == 0 && i+1 < argc) {
+			if (!parseFrameRate(argv[++i], &rateNumerator, &rateDenominator)) {
+				fprintf(stderr, "Usage: keyboard-recorder [--hz rate] [--start frame] [--replay minutes] [--verify] [recording.rec]\n");
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--start") == 0 && i+1 < argc) {
+			startFrame = (uint32)strtoul(argv[++i], 0, 10);
+		}
+		else if (strcmp(argv[i], "--replay") == 0 && i+1 < argc) {
+			replayMinutes = atof(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--verify") == 0) {
+			verify = true;
+		}
+		else recordingPath = argv[i];
+	}
+	RecorderThread recorder = {};
+	static LinuxBackend linuxBackend;
+	if (!initLinuxBackend(&recorder.data.backend, &linuxBackend, verify)) {
+		fprintf(stderr, "No keyboards found in /dev/input. Check that you can read the event devices.\n");
+		return 1;
+	}
+	if (linuxBackend.uinput < 0) {
+		fprintf(stderr, "Could not create a uinput device, playback is disabled.\n");
+	}
+	if (verify && linuxBackend.loopback < 0) {
+		fprintf(stderr, "Could not read back the uinput device, so playback can't be verified.\n");
+		shutdownLinuxBackend(&linuxBackend);
+		return 1;
+	}
+	signal(SIGINT, handleQuitSignal);
+	signal(SIGTERM, handleQuitSignal);
+
+	// F1 to F4, the same defaults as the Windows build
+	recorder.data.startRecordingKey.scancode = 0x3B;
+	recorder.data.playbackRecordingKey.scancode = 0x3C;
+	recorder.data.stopPlaybackKey.scancode = 0x3D;
+	recorder.data.saveReplayKey.scancode = 0x3E;
+	recorder.data.enabled = true;
+	static ReplayBuffer replayBuffer;
+	recorder.data.replay = &replayBuffer;
+	static TimingStats timing;
+	recorder.data.timing = &timing;
+	recorder.data.instantReplay = replayMinutes > 0;
+	recorder.data.replayWindow = (uint64)(replayMinutes * 60 * 1000000000.0);
+
+	recorder.onModeChange = wakeMainThread;
+	// clock_nanosleep rarely oversleeps by more than timer slack, which is 50us by default
+	initFrameClock(&recorder.data.clock, rateNumerator, rateDenominator, 100000);
+
+	// Recordings are journaled as they are made, next to the recording file if there is one
+	static char journalPath[4096];
+	snprintf(journalPath, sizeof(journalPath), "%s.journal", recordingPath ? recordingPath : "keyboard-recorder");
+
+	// An interrupted recording in the journal is newer than the saved one. Both are read before the
+	// journal starts, since starting a recording would overwrite it.
+	Recording recording = {0};
+	bool journalFinished = false;
+	if (recoverJournal(&recording, journalPath, &journalFinished) && (!journalFinished || !recordingPath)) {
+		printf("%s %u inputs from %s\n", journalFinished ? "Restored" : "Recovered an interrupted recording of", recording.inputCount, journalPath);
+		replaceRecording(&recorder.data, recording);
+	}
+	else if (recordingPath) {
+		// Text recordings take the current frame rate
+		LoadError error;
+		if (loadRecordingFile(&recording, recordingPath, &recorder.data.clock, &error)) {
+			printf("Loaded %u inputs from %s\n", recording.inputCount, recordingPath);
+			replaceRecording(&recorder.data, recording);
+		}
+		else {
+			if (access(recordingPath, F_OK) == 0) {
+				if (error.line) fprintf(stderr, "%s:%u: %s\n", recordingPath, error.line, error.reason);
+				else fprintf(stderr, "%s: %s\n", recordingPath, error.reason);
+			}
+			freeRecording(&recording);
+		}
+	}
+	else {
+		freeRecording(&recording);
+	}
+
+	static Journal journal;
+	startJournal(&journal, journalPath);
+	recorder.journal = &journal;
+	startRecorderThread(&recorder);
+	if (startFrame) {
+		RecorderStatus before = getRecorderStatus(&recorder);
+		RecorderStatus after = before;
+		after.playbackStartFrame = startFrame;
+		applyStatusChanges(&recorder, before, after);
+	}
+
+	if (verify) {
+		RecorderStatus status = getRecorderStatus(&recorder);
+		printf("Verifying playback of %u inputs in 3 seconds\n", status.recordingCount);
+		fflush(stdout);
+		std::this_thread::sleep_for(std::chrono::seconds(3));
+		uint32 verificationCount = status.verificationCount;
+		startVerification(&recorder);
+		// The recorder finishes it a moment after playback ends, once the last keys have come back
+		while (!quitRequested && getRecorderStatus(&recorder).verificationCount == verificationCount) {
+			std::unique_lock<std::mutex> guard(wakeLock);
+			wakeCondition.wait_for(guard, std::chrono::milliseconds(250));
+		}
+		status = getRecorderStatus(&recorder);
+		if (status.verificationCount != verificationCount) {
+			char text[512];
+			formatFidelityReport(text, sizeof(text), &status.verification, &recorder.verificationDelay);
+			fputs(text, stdout);
+		}
+		quitRequested = 1;
+	}
+
+	// Sleep until the recorder changes mode. The timeout is only there to notice quit signals.
+	Mode previousMode = Mode_idle;
+	uint32 previousReplaySaveCount = 0;
+	while (!quitRequested)
+	{
+		{
+			std::unique_lock<std::mutex> guard(wakeLock);
+			wakeCondition.wait_for(guard, std::chrono::milliseconds(250));
+		}
+
+		RecorderStatus status = getRecorderStatus(&recorder);
+		if (status.mode != previousMode) {
+			printf("%s\n", modeName(status.mode));
+			fflush(stdout);
+			if (previousMode == Mode_recording && recordingPath) {
+				saveRecording(&recorder, recordingPath);
+			}
+			previousMode = status.mode;
+		}
+		if (status.replaySaveCount != previousReplaySaveCount) {
+			printf("saved replay of %u inputs\n", status.recordingCount);
+			fflush(stdout);
+			if (recordingPath) {
+				saveRecording(&recorder, recordingPath);
+			}
+			previousReplaySaveCount = status.replaySaveCount;
+		}
+	}
+
+	stopRecorderThread(&recorder);
+	stopJournal(&journal);
+#ifdef PROFILE
+	static char tracePath[4096];
+	snprintf(tracePath, sizeof(tracePath), "%s.trace.json", recordingPath ? recordingPath : "keyboard-recorder");
+	if (PROFILE_WRITE_TRACE(tracePath)) printf("Wrote a profile to %s\n", tracePath);
+#endif
+	RecorderStatus status = getRecorderStatus(&recorder);
+	printf("Frame error: %.3fms avg, %.3fms worst\n", status.averageFrameError / 1000000.0, status.worstFrameError / 1000000.0);
+	writeTimingStats(&timing, stdout);
+	shutdownLinuxBackend(&linuxBackend);
+	return 0;
+}
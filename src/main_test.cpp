@@ -0,0 +1,811 @@
+// Checks for the recorder core, run against MemoryBackend and Simulation so they need no keyboard,
+// window or real time. Prints each failed check and exits with 1 if any failed:
+//   ./keyboard-recorder-test
+// Temporary recordings are written to keyboard-recorder-test.rec and .journal, which are deleted afterwards.
+#include "Journal.h"
+#include "KeyNames.h"
+#include "RecordingFile.h"
+#include "Simulation.h"
+#include "Verify.h"
+
+uint checkCount;
+uint failedCount;
+
+#define CHECK(condition) checkResult((condition), #condition, __FILE__, __LINE__)
+
+void checkResult(bool passed, const char* condition, const char* file, int line)
+{
+	++checkCount;
+	if (!passed) {
+		++failedCount;
+		printf("%s:%d: failed: %s\n", file, line, condition);
+	}
+}
+
+const char* testPath = "keyboard-recorder-test.rec";
+const char* testJournalPath = "keyboard-recorder-test.journal";
+
+KeyInput testKey(unsigned short scancode, unsigned int extended, KeyInput::Type type)
+{
+	KeyInput key = {0};
+	key.scancode = scancode;
+	key.extended = extended;
+	key.type = type;
+	return key;
+}
+
+// Appends key at fraction/16 of the way through frame
+void appendTestInput(Recording* recording, KeyInput key, uint32 frame, uint64 fraction)
+{
+	RecordedInput input = {0};
+	input.key = key;
+	input.frame = frame;
+	uint64 start = timeAtFrame(&recording->clock, frame);
+	input.time = start + (timeAtFrame(&recording->clock, frame + 1) - start) * fraction / 16;
+	CHECK(appendInput(recording, input));
+}
+
+bool sameEvents(Recording* a, Recording* b)
+{
+	if (a->events.count != b->events.count || a->frameIndex.count != b->frameIndex.count) return false;
+	for (uint i=0; i<a->events.count; ++i) {
+		if (a->events[i] != b->events[i]) return false;
+	}
+	for (uint i=0; i<a->frameIndex.count; ++i) {
+		if (a->frameIndex[i].position != b->frameIndex[i].position || a->frameIndex[i].frame != b->frameIndex[i].frame) return false;
+	}
+	return a->inputCount == b->inputCount && a->end.frame == b->end.frame;
+}
+
+// A recording with extended keys, releases, inputs sharing a frame and gaps that need escape words
+void makeTestRecording(Recording* recording, FrameClock* clock)
+{
+	clearRecording(recording, clock);
+	appendTestInput(recording, testKey(0x1E, 0, KeyInput::press), 0, 0);
+	appendTestInput(recording, testKey(0x1E, 0, KeyInput::release), 3, 5);
+	appendTestInput(recording, testKey(0x4B, 1, KeyInput::press), 3, 15);
+	appendTestInput(recording, testKey(0x4B, 1, KeyInput::release), 254, 8);
+	appendTestInput(recording, testKey(0x2C, 0, KeyInput::press), 254 + 300, 1);
+	appendTestInput(recording, testKey(0x2C, 0, KeyInput::release), 254 + 300 + 0xFFFFFF + 300, 9);
+}
+
+void testPacking()
+{
+	FrameClock clock;
+	initFrameClock(&clock, 60000, 1001, 0);
+	Recording recording = {0};
+	makeTestRecording(&recording, &clock);
+	// 6 inputs, one escape for the 300 frame gap and two for the gap over 0xFFFFFF
+	CHECK(recording.inputCount == 6);
+	CHECK(recording.events.count == 9);
+	CHECK(recording.events[4] >> 24 == packedFrameEscape && (recording.events[4] & 0xFFFFFF) == 300);
+	CHECK(recording.events[6] >> 24 == packedFrameEscape && recording.events[7] >> 24 == packedFrameEscape);
+
+	// Unpacking gives the keys and frames back, and packing what was unpacked gives the same bits
+	const uint32 frames[] = {0, 3, 3, 254, 554, 554 + 0xFFFFFF + 300};
+	Recording repacked = {0};
+	clearRecording(&repacked, &clock);
+	RecordingCursor cursor = {0};
+	RecordedInput input;
+	uint count = 0;
+	while (readInput(&recording, &cursor, &input)) {
+		CHECK(input.frame == frames[count]);
+		CHECK(frameAtTime(&clock, input.time) == input.frame);
+		CHECK(appendInput(&repacked, input));
+		++count;
+	}
+	CHECK(count == 6);
+	CHECK(sameEvents(&recording, &repacked));
+
+	cursor = firstInputAtFrame(&recording, 4);
+	CHECK(readInput(&recording, &cursor, &input) && input.frame == 254 && input.key.extended == 1 && input.key.type == KeyInput::release);
+	cursor = firstInputAtFrame(&recording, 555);
+	CHECK(readInput(&recording, &cursor, &input) && input.frame == frames[5]);
+	CHECK(!readInput(&recording, &cursor, &input));
+
+	// The frame index can't reach past maxRecordingFrame, and nothing is appended when it fails
+	uint eventCount = recording.events.count;
+	CHECK(!appendPackedInput(&recording, maxRecordingFrame + 1, 0x1E));
+	CHECK(recording.events.count == eventCount && recording.inputCount == 6);
+	CHECK(appendPackedInput(&recording, maxRecordingFrame, 0x1E));
+	CHECK(recording.inputCount == 7);
+
+	freeRecording(&recording);
+	freeRecording(&repacked);
+
+	SegmentedArray<uint, 0> full = {0};
+	for (uint i=0; i<full.capacity; ++i) full.push_back(i);
+	CHECK(!full.push_back(0));
+	CHECK(full.count == full.capacity && full[full.capacity - 1] == full.capacity - 1);
+	full.freeMemory();
+}
+
+// A copy of the recording struct taken earlier catches up to what was appended after it
+void testPublishedCount()
+{
+	FrameClock clock;
+	initFrameClock(&clock, 60, 1, 0);
+	Recording recording = {0};
+	clearRecording(&recording, &clock);
+	Recording snapshot = recording;
+	catchUpToPublished(&snapshot);
+	CHECK(snapshot.inputCount == 0 && snapshot.events.count == 0 && snapshot.frameIndex.count == 0);
+
+	appendTestInput(&recording, testKey(0x1E, 0, KeyInput::press), 3, 0);
+	snapshot = recording;
+	appendTestInput(&recording, testKey(0x1E, 0, KeyInput::release), 200, 4);
+	appendTestInput(&recording, testKey(0x4B, 1, KeyInput::press), 300 + 0xFFFFFF, 9);
+	// An escape published ahead of the input it belongs to is left out
+	Recording expected = recording;
+	CHECK(recording.events.push_back(packedFrameEscape << 24 | 1000));
+	CHECK(recording.events.publishedCount() == expected.events.count + 1);
+	catchUpToPublished(&snapshot);
+	CHECK(sameEvents(&expected, &snapshot));
+	freeRecording(&recording);
+}
+
+// Parses text and checks it fails with reason on line, or succeeds if reason is null
+void checkTextRecording(const char* text, const char* reason, uint line, int fileLine)
+{
+	FrameClock clock;
+	initFrameClock(&clock, 60, 1, 0);
+	Recording recording = {0};
+	LoadError error = {0};
+	bool loaded = readTextRecording(&recording, text, strlen(text), &clock, &error);
+	bool passed = reason ? !loaded && strcmp(error.reason, reason) == 0 && error.line == line : loaded && error.line == 0;
+	checkResult(passed, text, __FILE__, fileLine);
+	freeRecording(&recording);
+}
+
+void testTextRecordings()
+{
+	checkTextRecording("30 0 0 5 @83333334 A\r\n\n  48 1 1 7\n", 0, 0, __LINE__);
+	checkTextRecording("30 0 0 5\nx 0 0 6\n", "Bad scancode", 2, __LINE__);
+	checkTextRecording("\n30 x 0 5\n", "Bad extended flag", 2, __LINE__);
+	checkTextRecording("30 0 0 5\n30 0 0 6\n30 0 3 7\n", "Bad press or release", 3, __LINE__);
+	checkTextRecording("30 0 0 -5\n", "Bad frame", 1, __LINE__);
+	checkTextRecording("30 0 0 5 @1x\n", "Bad time", 1, __LINE__);
+	checkTextRecording("30 0 0 5A\n", "Bad frame", 1, __LINE__);
+	checkTextRecording("30 0 0 10\n30 0 1 9\n", "Frame is before the previous input's", 2, __LINE__);
+	checkTextRecording("30 0 0 300000000\n", "Frame is too far in for a recording", 1, __LINE__);
+	checkTextRecording("256 0 0 5\n", "Bad scancode", 1, __LINE__);
+
+	// Lines without a time get the start of their frame, and names are ignored
+	FrameClock clock;
+	initFrameClock(&clock, 60, 1, 0);
+	Recording recording = {0};
+	LoadError error;
+	const char* text = "30 0 0 5 A\n48 1 1 7 @120000000 B";
+	CHECK(readTextRecording(&recording, text, strlen(text), &clock, &error));
+	RecordingCursor cursor = {0};
+	RecordedInput input;
+	CHECK(readInput(&recording, &cursor, &input) && input.frame == 5 && input.time == timeAtFrame(&clock, 5) && input.key.scancode == 30);
+	CHECK(readInput(&recording, &cursor, &input) && input.frame == 7 && input.key.extended == 1 && input.key.type == KeyInput::release);
+
+	// Older versions saved the extended flag as 2, and "@" is a key name on JIS layouts
+	text = "30 2 0 5\n26 0 0 6 @\n27 0 0 7 @120000000 @\n";
+	CHECK(readTextRecording(&recording, text, strlen(text), &clock, &error));
+	cursor = {0};
+	CHECK(readInput(&recording, &cursor, &input) && input.frame == 5 && input.key.extended == 1 && input.key.scancode == 30);
+	CHECK(readInput(&recording, &cursor, &input) && input.frame == 6 && input.time == timeAtFrame(&clock, 6) && input.key.scancode == 26);
+	CHECK(readInput(&recording, &cursor, &input) && input.frame == 7 && input.time > timeAtFrame(&clock, 7));
+	freeRecording(&recording);
+}
+
+bool writeTestFile(const unsigned char* bytes, size_t size)
+{
+	FILE* file = fopen(testPath, "wb");
+	if (!file) return false;
+	bool written = fwrite(bytes, 1, size, file) == size;
+	fclose(file);
+	return written;
+}
+
+// Writes recording in the version 2 layout described in RecordingFile.h
+size_t writeVersion2(Recording* recording, unsigned char* buffer)
+{
+	memcpy(buffer, recordingMagic, 4);
+	unsigned char* out = writeLittleEndian(buffer + 4, 2, 2);
+	out = writeLittleEndian(out, 0, 2);
+	out = writeLittleEndian(out, recording->clock.rateNumerator, 8);
+	out = writeLittleEndian(out, recording->clock.rateDenominator, 8);
+	out = writeLittleEndian(out, recording->inputCount, 4);
+	uint32 delta = 0;
+	for (uint i=0; i<recording->events.count; ++i) {
+		PackedInput packed = recording->events[i];
+		if (packed >> 24 == packedFrameEscape) {
+			delta += packed & 0xFFFFFF;
+			continue;
+		}
+		delta += packed >> 24;
+		for (; delta >= 0x80; delta >>= 7) *out++ = (unsigned char)(delta | 0x80);
+		*out++ = (unsigned char)delta;
+		out = writeLittleEndian(out, packed & 0xFFFFFF, 3);
+		delta = 0;
+	}
+	out = writeLittleEndian(out, fnv1a(buffer, out - buffer), 4);
+	return out - buffer;
+}
+
+void testRecordingFiles()
+{
+	FrameClock clock;
+	initFrameClock(&clock, 60000, 1001, 0);
+	FrameClock textClock;
+	initFrameClock(&textClock, 60, 1, 0);
+	Recording recording = {0};
+	makeTestRecording(&recording, &clock);
+	LoadError error;
+
+	// Version 3 is mapped and reads back identically
+	FILE* file = fopen(testPath, "wb");
+	CHECK(file && writeRecording(&recording, file));
+	if (file) fclose(file);
+	Recording loaded = {0};
+	CHECK(loadRecordingFile(&loaded, testPath, &textClock, &error));
+	CHECK(loaded.mapping.bytes != 0);
+	CHECK(loaded.clock.rateNumerator == 60000 && loaded.clock.rateDenominator == 1001);
+	CHECK(sameEvents(&recording, &loaded));
+
+	// Saving over the file the loaded recording is mapped from leaves the mapping reading the old one
+	Recording other = {0};
+	clearRecording(&other, &clock);
+	appendTestInput(&other, testKey(0x1F, 0, KeyInput::press), 9, 0);
+	CHECK(saveRecordingFile(&other, testPath));
+	CHECK(sameEvents(&recording, &loaded));
+	freeRecording(&loaded);
+	CHECK(loadRecordingFile(&loaded, testPath, &textClock, &error));
+	CHECK(sameEvents(&other, &loaded));
+	freeRecording(&loaded);
+	freeRecording(&other);
+	CHECK(saveRecordingFile(&recording, testPath));
+
+	// A changed header fails its checksum
+	MappedFile mapped;
+	CHECK(mapFile(&mapped, testPath));
+	unsigned char* bytes = (unsigned char*)malloc(mapped.size);
+	size_t size = mapped.size;
+	memcpy(bytes, mapped.bytes, size);
+	unmapFile(&mapped);
+	bytes[24] ^= 1;
+	CHECK(writeTestFile(bytes, size));
+	CHECK(!loadRecordingFile(&loaded, testPath, &textClock, &error));
+	freeRecording(&loaded);
+	free(bytes);
+
+	// Version 2 is converted in memory to the same events
+	unsigned char buffer[256];
+	size = writeVersion2(&recording, buffer);
+	CHECK(writeTestFile(buffer, size));
+	CHECK(loadRecordingFile(&loaded, testPath, &textClock, &error));
+	CHECK(loaded.mapping.bytes == 0);
+	CHECK(sameEvents(&recording, &loaded));
+	freeRecording(&loaded);
+
+	// A cut off version 2 file fails its checksum
+	CHECK(writeTestFile(buffer, size - 1));
+	CHECK(!loadRecordingFile(&loaded, testPath, &textClock, &error));
+	freeRecording(&loaded);
+
+	freeRecording(&recording);
+	remove(testPath);
+}
+
+// Writes a journal block of count words starting at words. Returns the end of the block.
+unsigned char* writeJournalBlock(unsigned char* out, const PackedInput* words, uint count)
+{
+	out = writeLittleEndian(out, count, 4);
+	out = writeLittleEndian(out, fnv1a((unsigned char*)words, count * 4), 4);
+	memcpy(out, words, count * 4);
+	return out + count * 4;
+}
+
+bool recoverTestJournal(const unsigned char* bytes, size_t size, uint* inputCount, bool* finished)
+{
+	FILE* file = fopen(testJournalPath, "wb");
+	if (!file) return false;
+	fwrite(bytes, 1, size, file);
+	fclose(file);
+	Recording recovered = {0};
+	bool result = recoverJournal(&recovered, testJournalPath, finished);
+	*inputCount = recovered.inputCount;
+	freeRecording(&recovered);
+	return result;
+}
+
+void testJournal()
+{
+	FrameClock clock;
+	initFrameClock(&clock, 60, 1, 0);
+	Recording recording = {0};
+	clearRecording(&recording, &clock);
+	for (uint32 frame = 0; frame < 4; ++frame) {
+		appendTestInput(&recording, testKey(0x1E, 0, frame & 1 ? KeyInput::release : KeyInput::press), frame, 0);
+	}
+	PackedInput words[4];
+	for (uint i=0; i<4; ++i) words[i] = recording.events[i];
+
+	// Two blocks of two inputs, then the end block
+	unsigned char buffer[128];
+	memcpy(buffer, journalMagic, 4);
+	unsigned char* out = writeLittleEndian(buffer + 4, 1, 2);
+	out = writeLittleEndian(out, 0, 2);
+	out = writeLittleEndian(out, 60, 8);
+	out = writeLittleEndian(out, 1, 8);
+	unsigned char* firstBlock = out;
+	out = writeJournalBlock(out, words, 2);
+	unsigned char* secondBlock = out;
+	out = writeJournalBlock(out, words + 2, 2);
+	unsigned char* endBlock = out;
+	out = writeLittleEndian(out, 0, 8);
+	size_t size = out - buffer;
+	uint inputCount;
+	bool finished;
+	CHECK(recoverTestJournal(buffer, size, &inputCount, &finished) && inputCount == 4 && finished);
+
+	// Without the end block the recording was interrupted, but all of it is there
+	CHECK(recoverTestJournal(buffer, endBlock - buffer, &inputCount, &finished) && inputCount == 4 && !finished);
+
+	// A final block cut short is dropped
+	CHECK(recoverTestJournal(buffer, endBlock - buffer - 1, &inputCount, &finished) && inputCount == 2 && !finished);
+
+	// So is everything from a block that fails its checksum, even a valid end block after it
+	secondBlock[8] ^= 1;
+	CHECK(recoverTestJournal(buffer, size, &inputCount, &finished) && inputCount == 2 && !finished);
+	CHECK(!recoverTestJournal(buffer, firstBlock - buffer, &inputCount, &finished));
+
+	// A recording loaded while the journal still follows the last one finishes it without adding its own events
+	AppData data = {};
+	MemoryBackend memory;
+	initMemoryBackend(&data.backend, &memory);
+	initFrameClock(&data.clock, 60, 1, 0);
+	static Journal journal;
+	startJournal(&journal, testJournalPath);
+	startRecording(&data, 0);
+	appendTestInput(&data.recording, testKey(0x1E, 0, KeyInput::press), 1, 0);
+	appendTestInput(&data.recording, testKey(0x1E, 0, KeyInput::release), 2, 0);
+	updateJournal(&journal, &data);
+	Recording loaded = {0};
+	makeTestRecording(&loaded, &clock);
+	replaceRecording(&data, loaded);
+	updateJournal(&journal, &data);
+	stopJournal(&journal);
+	Recording recovered = {0};
+	CHECK(recoverJournal(&recovered, testJournalPath, &finished) && recovered.inputCount == 2 && finished);
+	freeRecording(&recovered);
+
+	freeRecording(&data.recording);
+	freeRecording(&recording);
+	remove(testJournalPath);
+}
+
+void testFrameTimes()
+{
+	const uint64 rates[][2] = {{60, 1}, {60000, 1001}, {144, 1}, {30000, 1001}, {1, 3}, {5994, 100}};
+	for (uint r=0; r<sizeof(rates)/sizeof(rates[0]); ++r) {
+		FrameClock clock;
+		initFrameClock(&clock, rates[r][0], rates[r][1], 0);
+		startFrameClock(&clock, 1000);
+		bool exact = true;
+		bool roundTrips = true;
+		bool deadlines = true;
+		for (uint32 frame = 0; frame < 200000; ++frame) {
+			// timeAtFrame is ceil(frame / rate) in nanoseconds
+			uint64 time = timeAtFrame(&clock, frame);
+			uint64 scaled = (uint64)frame * clock.rateDenominator * 1000000000ull;
+			exact = exact && time * clock.rateNumerator >= scaled && (time == 0 || (time - 1) * clock.rateNumerator < scaled);
+			roundTrips = roundTrips && frameAtTime(&clock, time) == frame && (frame == 0 || frameAtTime(&clock, time - 1) == frame - 1);
+			// Deadlines fall on the same nanoseconds from the start of the clock
+			if (frame > 0) {
+				deadlines = deadlines && clock.nextFrameTime == 1000 + time;
+				advanceFrame(&clock);
+			}
+		}
+		CHECK(exact);
+		CHECK(roundTrips);
+		CHECK(deadlines);
+		// Many hours in, where the products need splitting to fit in 64 bits
+		uint64 hours = 100ull * 3600 * 1000000000ull;
+		CHECK(timeAtFrame(&clock, frameAtTime(&clock, hours)) <= hours);
+		CHECK(timeAtFrame(&clock, frameAtTime(&clock, hours) + 1) > hours);
+	}
+
+	uint64 numerator, denominator;
+	CHECK(parseFrameRate("59.94", &numerator, &denominator) && numerator == 5994 && denominator == 100);
+	CHECK(parseFrameRate("60000/1001", &numerator, &denominator) && numerator == 60000 && denominator == 1001);
+	CHECK(!parseFrameRate("60/0", &numerator, &denominator));
+	CHECK(!parseFrameRate("sixty", &numerator, &denominator));
+}
+
+// Runs the recorder a frame at a time by hand, with keys queued straight into the backend
+void stepTestFrame(AppData* data, MemoryBackend* memory, DynamicArray<KeyInput>* keyEvents)
+{
+	sleepUntil(&data->backend, data->clock.nextFrameTime);
+	keyEvents->clear();
+	captureKeys(&data->backend, keyEvents);
+	stepRecorder(data, *keyEvents, true);
+}
+
+void testInjectBatches()
+{
+	AppData data = {};
+	MemoryBackend memory;
+	initMemoryBackend(&data.backend, &memory);
+	data.playbackRecordingKey.scancode = 0x3C;
+	data.enabled = true;
+	initFrameClock(&data.clock, 60, 1, 0);
+	startFrameClock(&data.clock, 0);
+	clearRecording(&data.recording, &data.clock);
+	// Three keys on frame 2, two on frame 5 and one on frame 6
+	appendTestInput(&data.recording, testKey(0x1E, 0, KeyInput::press), 2, 1);
+	appendTestInput(&data.recording, testKey(0x1F, 0, KeyInput::press), 2, 4);
+	appendTestInput(&data.recording, testKey(0x20, 0, KeyInput::press), 2, 15);
+	appendTestInput(&data.recording, testKey(0x1E, 0, KeyInput::release), 5, 2);
+	appendTestInput(&data.recording, testKey(0x1F, 0, KeyInput::release), 5, 3);
+	appendTestInput(&data.recording, testKey(0x20, 0, KeyInput::release), 6, 0);
+
+	DynamicArray<KeyInput> keyEvents = {0};
+	queueKey(&memory, 0x3C, KeyInput::press);
+	stepTestFrame(&data, &memory, &keyEvents);
+	CHECK(data.mode == Mode_playback);
+	uint calls[8];
+	uint injected[8];
+	for (uint frame = 0; frame < 8; ++frame) {
+		stepTestFrame(&data, &memory, &keyEvents);
+		calls[frame] = memory.injectCallCount;
+		injected[frame] = memory.injectedKeys.count;
+	}
+	// The frame the playback key was seen on counts as frame 0, so frame f's inputs go out on step f - 1.
+	// One call per frame that has inputs, with all of them in it.
+	CHECK(calls[0] == 0 && injected[0] == 0);
+	CHECK(calls[1] == 1 && injected[1] == 3);
+	CHECK(calls[3] == 1 && injected[3] == 3);
+	CHECK(calls[4] == 2 && injected[4] == 5);
+	CHECK(calls[5] == 3 && injected[5] == 6);
+	CHECK(calls[7] == 3);
+	CHECK(data.mode == Mode_idle);
+	CHECK(memory.injectedKeys[0].scancode == 0x1E && memory.injectedKeys[2].scancode == 0x20);
+
+	freeRecording(&data.recording);
+	data.injectBatch.freeMemory();
+	memory.pendingKeys.freeMemory();
+	memory.injectedKeys.freeMemory();
+	keyEvents.freeMemory();
+}
+
+// Keys are only bound while the window has focus, so typing into another window doesn't bind them
+void testKeyBinding()
+{
+	AppData data = {};
+	MemoryBackend memory;
+	initMemoryBackend(&data.backend, &memory);
+	data.startRecordingKey.scancode = 0x3B;
+	data.enabled = true;
+	initFrameClock(&data.clock, 60, 1, 0);
+	startFrameClock(&data.clock, 0);
+	data.mode = Mode_waitingForRecordKey;
+
+	DynamicArray<KeyInput> keyEvents = {0};
+	queueKey(&memory, 0x1E, KeyInput::press);
+	stepTestFrame(&data, &memory, &keyEvents);
+	CHECK(data.mode == Mode_waitingForRecordKey && data.startRecordingKey.scancode == 0x3B);
+	data.windowActive = true;
+	queueKey(&memory, 0x1F, KeyInput::press);
+	stepTestFrame(&data, &memory, &keyEvents);
+	CHECK(data.mode == Mode_idle && data.startRecordingKey.scancode == 0x1F);
+
+	data.injectBatch.freeMemory();
+	memory.pendingKeys.freeMemory();
+	memory.injectedKeys.freeMemory();
+	keyEvents.freeMemory();
+}
+
+// A full ring drops new keys and counts them rather than overwriting keys not yet read
+void testCaptureRing()
+{
+	static CaptureRing ring;
+	ring.clear();
+	uint pushed = 0;
+	for (uint i=0; i<1024; ++i) pushed += ring.push(testKey((unsigned short)(i & 0xFF), 0, KeyInput::press));
+	CHECK(pushed == 1024);
+	CHECK(!ring.push(testKey(0x1E, 0, KeyInput::release)));
+	CHECK(!ring.push(testKey(0x1E, 0, KeyInput::release)));
+	CHECK(ring.overflows() == 2);
+
+	DynamicArray<KeyInput> keys = {0};
+	drainCaptureRing(&ring, &keys);
+	CHECK(keys.count == 1024 && keys[0].scancode == 0 && keys[1023].scancode == 0xFF && keys[1023].type == KeyInput::press);
+	CHECK(ring.push(testKey(0x1F, 0, KeyInput::press)));
+	keys.clear();
+	drainCaptureRing(&ring, &keys);
+	CHECK(keys.count == 1 && keys[0].scancode == 0x1F);
+	CHECK(ring.overflows() == 2);
+	keys.freeMemory();
+}
+
+void testKeyState()
+{
+	KeyState state = {0};
+	updateKeyState(&state, testKey(0x1E, 0, KeyInput::press));
+	updateKeyState(&state, testKey(0x4B, 1, KeyInput::press));
+	updateKeyState(&state, testKey(0x4B, 0, KeyInput::press));
+	updateKeyState(&state, testKey(0x4B, 0, KeyInput::release));
+	CHECK(isKeyDown(&state, testKey(0x1E, 0, KeyInput::press)));
+	CHECK(isKeyDown(&state, testKey(0x4B, 1, KeyInput::press)));
+	CHECK(!isKeyDown(&state, testKey(0x4B, 0, KeyInput::press)));
+	DynamicArray<KeyInput> releases = {0};
+	appendKeyReleases(&state, &releases);
+	CHECK(releases.count == 2);
+	CHECK(releases[0].scancode == 0x1E && !releases[0].extended && releases[0].type == KeyInput::release);
+	CHECK(releases[1].scancode == 0x4B && releases[1].extended && releases[1].type == KeyInput::release);
+	releases.freeMemory();
+
+	// Stopping playback releases whatever it's holding down, and only that
+	AppData data = {};
+	MemoryBackend memory;
+	initMemoryBackend(&data.backend, &memory);
+	data.playbackRecordingKey.scancode = 0x3C;
+	data.stopPlaybackKey.scancode = 0x3D;
+	data.enabled = true;
+	initFrameClock(&data.clock, 60, 1, 0);
+	startFrameClock(&data.clock, 0);
+	clearRecording(&data.recording, &data.clock);
+	appendTestInput(&data.recording, testKey(0x1E, 0, KeyInput::press), 1, 0);
+	appendTestInput(&data.recording, testKey(0x1F, 0, KeyInput::press), 1, 1);
+	appendTestInput(&data.recording, testKey(0x1E, 0, KeyInput::release), 2, 0);
+	appendTestInput(&data.recording, testKey(0x1F, 0, KeyInput::release), 50, 0);
+
+	DynamicArray<KeyInput> keyEvents = {0};
+	queueKey(&memory, 0x3C, KeyInput::press);
+	stepTestFrame(&data, &memory, &keyEvents);
+	for (uint frame = 0; frame < 4; ++frame) stepTestFrame(&data, &memory, &keyEvents);
+	CHECK(data.mode == Mode_playback && memory.injectedKeys.count == 3);
+	CHECK(!isKeyDown(&data.heldKeys, testKey(0x1E, 0, KeyInput::press)) && isKeyDown(&data.heldKeys, testKey(0x1F, 0, KeyInput::press)));
+	queueKey(&memory, 0x3D, KeyInput::press);
+	stepTestFrame(&data, &memory, &keyEvents);
+	CHECK(data.mode == Mode_idle && memory.injectedKeys.count == 4);
+	KeyInput last = memory.injectedKeys[3];
+	CHECK(last.scancode == 0x1F && last.type == KeyInput::release);
+	CHECK(!isKeyDown(&data.heldKeys, last));
+
+	freeRecording(&data.recording);
+	data.injectBatch.freeMemory();
+	memory.pendingKeys.freeMemory();
+	memory.injectedKeys.freeMemory();
+	keyEvents.freeMemory();
+}
+
+// The replay buffer keeps the newest replayCapacity events, and a saved replay only takes the window before the key
+void testReplay()
+{
+	static ReplayBuffer replay;
+	clearReplay(&replay);
+	const uint64 millisecond = 1000000;
+	for (uint i=0; i<replayCapacity + 10; ++i) {
+		KeyInput key = testKey((unsigned short)(0x10 + i % 8), 0, i % 16 < 8 ? KeyInput::press : KeyInput::release);
+		key.time = i * millisecond;
+		pushReplayEvent(&replay, key);
+	}
+	CHECK(replay.count == replayCapacity && replay.next == 10);
+	CHECK(replayEventAt(&replay, 0)->time == 10 * millisecond);
+	CHECK(replayEventAt(&replay, replayCapacity - 1)->time == (replayCapacity + 9) * millisecond);
+	KeyInput key = replayEventKey(replayEventAt(&replay, replayCapacity - 1));
+	CHECK(key.scancode == 0x10 + (replayCapacity + 9) % 8 && key.type == KeyInput::release);
+
+	// The window's first event is a press, since releases of keys pressed before the window are dropped.
+	// Events after the key that saved the replay are left out too.
+	AppData data = {};
+	initFrameClock(&data.clock, 1000, 1, 0);
+	data.replay = &replay;
+	data.replayWindow = 100 * millisecond;
+	uint64 endTime = 60000 * millisecond + millisecond / 2;
+	saveReplay(&data, endTime);
+	CHECK(data.replaySaveCount == 1);
+	// Events 59901 to 60000 are in the window. 59901 to 59903 are releases, and 59904 is the first press.
+	CHECK(data.recording.inputCount == 60000 - 59904 + 1);
+	RecordingCursor cursor = {0};
+	RecordedInput input;
+	CHECK(readInput(&data.recording, &cursor, &input) && input.frame == 0 && input.key.type == KeyInput::press && input.key.scancode == 0x10);
+	RecordedInput lastInput = input;
+	while (readInput(&data.recording, &cursor, &input)) lastInput = input;
+	CHECK(lastInput.frame == 60000 - 59904);
+	freeRecording(&data.recording);
+}
+
+// Key names come from the backend once per refresh, and labels are only rebuilt when their key or the names change
+void testKeyLabels()
+{
+	MemoryBackend memory;
+	InputBackend backend;
+	initMemoryBackend(&backend, &memory);
+	static KeyNames names;
+	refreshKeyNames(&names, &backend);
+	CHECK(strcmp(keyToString(&names, testKey(0x1E, 0, KeyInput::press)), "0x1E") == 0);
+	CHECK(strcmp(keyToString(&names, testKey(0x4B, 1, KeyInput::press)), "E0 0x4B") == 0);
+
+	KeyLabel label = {0};
+	const char* text = keyLabel(&label, "Record key", &names, testKey(0x1E, 0, KeyInput::press));
+	CHECK(text == label.text && strcmp(text, "Record key: 0x1E") == 0);
+	// Marked so a rebuild shows
+	label.text[0] = '*';
+	CHECK(keyLabel(&label, "Record key", &names, testKey(0x1E, 0, KeyInput::release))[0] == '*');
+	CHECK(strcmp(keyLabel(&label, "Record key", &names, testKey(0x1E, 1, KeyInput::press)), "Record key: E0 0x1E") == 0);
+	label.text[0] = '*';
+	refreshKeyNames(&names, &backend);
+	CHECK(strcmp(keyLabel(&label, "Record key", &names, testKey(0x1E, 1, KeyInput::press)), "Record key: E0 0x1E") == 0);
+}
+
+void testIdleSimulation()
+{
+	Simulation sim;
+	initSimulation(&sim, 60, 1);
+	// Keys a second apart don't take a step per frame while idle or recording
+	scriptKey(&sim, 500000000, 0x3B, KeyInput::press);
+	scriptKey(&sim, 1500000000, 0x1E, KeyInput::press);
+	scriptKey(&sim, 2500000000ull, 0x1E, KeyInput::release);
+	scriptKey(&sim, 3500000000ull, 0x3B, KeyInput::press);
+	runSimulationScript(&sim);
+	CHECK(sim.data.mode == Mode_idle);
+	CHECK(sim.stepCount < 10);
+	CHECK(sim.idleWaitCount == sim.stepCount);
+	CHECK(sim.data.recording.inputCount == 2);
+	RecordingCursor cursor = {0};
+	RecordedInput input;
+	CHECK(readInput(&sim.data.recording, &cursor, &input) && input.frame == 60);
+	CHECK(readInput(&sim.data.recording, &cursor, &input) && input.frame == 120);
+
+	// Playback keeps frames, and comes back to waiting for keys when it ends
+	scriptKey(&sim, getTime(&sim.data.backend) + 1000, 0x3C, KeyInput::press);
+	runSimulationScript(&sim);
+	CHECK(sim.data.mode == Mode_playback);
+	uint64 idleWaits = sim.idleWaitCount;
+	CHECK(runSimulationWhile(&sim, Mode_playback, 1000));
+	CHECK(sim.idleWaitCount == idleWaits + 1);
+	CHECK(sim.injectionCount == 2);
+	CHECK(sim.injections.count == 2 && sim.injections[1].frame - sim.injections[0].frame == 60);
+	freeSimulation(&sim);
+}
+
+void testLoopbackAlignment()
+{
+	FrameClock clock;
+	initFrameClock(&clock, 60, 1, 0);
+	Recording played = {0};
+	Recording captured = {0};
+	clearRecording(&played, &clock);
+	clearRecording(&captured, &clock);
+	appendTestInput(&played, testKey(0x1E, 0, KeyInput::press), 1, 0);
+	appendTestInput(&played, testKey(0x1E, 0, KeyInput::release), 2, 0);
+	appendTestInput(&played, testKey(0x30, 0, KeyInput::press), 3, 0);
+	appendTestInput(&played, testKey(0x2E, 0, KeyInput::press), 4, 0);
+	appendTestInput(&played, testKey(0x12, 0, KeyInput::press), 4, 1);
+	appendTestInput(&played, testKey(0x30, 0, KeyInput::release), 5, 0);
+	appendTestInput(&played, testKey(0x1E, 0, KeyInput::press), 6, 0);
+
+	appendTestInput(&captured, testKey(0x1E, 0, KeyInput::press), 1, 1);   // On time
+	appendTestInput(&captured, testKey(0x20, 0, KeyInput::press), 2, 1);   // Never played
+	appendTestInput(&captured, testKey(0x1E, 0, KeyInput::release), 3, 1); // A frame late
+	appendTestInput(&captured, testKey(0x12, 0, KeyInput::press), 4, 2);   // Ahead of the key played before it
+	appendTestInput(&captured, testKey(0x2E, 0, KeyInput::press), 4, 3);
+	appendTestInput(&captured, testKey(0x30, 0, KeyInput::release), 5, 1);
+	// The press on frame 3 and the second press of 0x1E never come back
+
+	static Histogram delay;
+	FidelityReport report = compareLoopback(&played, 0, &captured, &delay);
+	CHECK(report.played == 7);
+	CHECK(report.captured == 6);
+	CHECK(report.onTime == 4);
+	CHECK(report.late == 1);
+	CHECK(report.worstFrameLag == 1);
+	CHECK(report.dropped == 2);
+	CHECK(report.extra == 1);
+	CHECK(report.reordered == 1);
+	CHECK(summarizeHistogram(&delay).count == 5);
+
+	// Starting later leaves out the inputs before the start frame
+	report = compareLoopback(&played, 4, &captured, 0);
+	CHECK(report.played == 4);
+	CHECK(report.onTime == 3);
+	CHECK(report.dropped == 1);
+	CHECK(report.extra == 3);
+
+	freeRecording(&played);
+	freeRecording(&captured);
+}
+
+// Verification keeps going for the grace period after playback ends, so the last keys played can come back
+void testVerificationGracePeriod()
+{
+	AppData data = {};
+	MemoryBackend memory;
+	initMemoryBackend(&data.backend, &memory);
+	memory.loopback = true;
+	data.enabled = true;
+	initFrameClock(&data.clock, 60, 1, 0);
+	startFrameClock(&data.clock, 0);
+	clearRecording(&data.recording, &data.clock);
+	appendTestInput(&data.recording, testKey(0x1E, 0, KeyInput::press), 2, 0);
+	appendTestInput(&data.recording, testKey(0x1E, 0, KeyInput::release), 3, 0);
+
+	DynamicArray<KeyInput> keyEvents = {0};
+	startVerification(&data, getTime(&data.backend));
+	uint steps = 0;
+	while (data.mode == Mode_playback && steps < 100) {
+		stepTestFrame(&data, &memory, &keyEvents);
+		++steps;
+	}
+	uint64 ended = getTime(&data.backend);
+	CHECK(data.mode == Mode_idle && keepsFrames(&data));
+	CHECK(!verificationDue(&data, ended));
+	while (!verificationDue(&data, getTime(&data.backend)) && steps < 100) {
+		stepTestFrame(&data, &memory, &keyEvents);
+		++steps;
+	}
+	CHECK(getTime(&data.backend) - ended >= verificationGracePeriod);
+	FidelityReport report = finishVerification(&data, 0);
+	CHECK(report.played == 2 && report.captured == 2 && report.dropped == 0);
+	CHECK(!data.verifying && !keepsFrames(&data));
+
+	freeRecording(&data.recording);
+	data.injectBatch.freeMemory();
+	memory.pendingKeys.freeMemory();
+	memory.injectedKeys.freeMemory();
+	keyEvents.freeMemory();
+}
+
+void testHistogram()
+{
+	static Histogram histogram;
+	clearHistogram(&histogram);
+	for (int64 value = 1; value <= 100; ++value) recordDuration(&histogram, value);
+	HistogramSummary small = summarizeHistogram(&histogram);
+	// Below 256 every value has its own bucket
+	CHECK(small.count == 100 && small.p50 == 50 && small.p90 == 90 && small.p99 == 99 && small.p999 == 100 && small.max == 100);
+
+	clearHistogram(&histogram);
+	for (int64 value = 1; value <= 1000000; ++value) recordDuration(&histogram, value * 1000);
+	recordDuration(&histogram, -5);
+	HistogramSummary summary = summarizeHistogram(&histogram);
+	CHECK(summary.count == 1000001);
+	CHECK(summary.max == 1000000000ull);
+	const uint64 exact[] = {500000000ull, 900000000ull, 990000000ull, 999000000ull};
+	const uint64 results[] = {summary.p50, summary.p90, summary.p99, summary.p999};
+	for (uint i=0; i<4; ++i) {
+		// Never understated, and within 1%
+		CHECK(results[i] >= exact[i] - 1000 && results[i] <= exact[i] + exact[i] / 100);
+	}
+	CHECK(summary.mean > 499000000ull && summary.mean < 501000000ull);
+
+	// Values past the last bucket still land in it
+	CHECK(histogramBucket(UINT64_MAX) == histogramBucketCount - 1);
+	for (uint64 value = 1; value < (1ull << 40); value = value * 3 + 1) {
+		uint bucket = histogramBucket(value);
+		CHECK(histogramBucketValue(bucket) >= value && (bucket == 0 || histogramBucketValue(bucket - 1) < value));
+	}
+}
+
+int main(int argc, char** argv)
+{
+	testPacking();
+	testPublishedCount();
+	testTextRecordings();
+	testRecordingFiles();
+	testJournal();
+	testFrameTimes();
+	testInjectBatches();
+	testKeyBinding();
+	testCaptureRing();
+	testKeyState();
+	testReplay();
+	testKeyLabels();
+	testIdleSimulation();
+	testLoopbackAlignment();
+	testVerificationGracePeriod();
+	testHistogram();
+	if (failedCount) {
+		printf("%u of %u checks failed\n", failedCount, checkCount);
+		return 1;
+	}
+	printf("All %u checks passed\n", checkCount);
+	return 0;
+}